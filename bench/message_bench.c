@@ -0,0 +1,460 @@
+/**
+ * @file message_bench.c
+ * @brief Micro-benchmarks of the hot paths on POSIX hosts.
+ *
+ * Runs a fixed set of workloads on seeded data and prints ns/op, ops/s
+ * and MB/s for each: CRC-32 over several sizes, the receive parser on
+ * synthetic byte streams, the message box and the frame builder. Every
+ * case is timed REPEATS times and the fastest run is reported, so a busy
+ * machine makes a run slower but rarely the report.
+ *
+ * Usage: message_bench [filter], only runs the cases whose name holds
+ * filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "message.h"
+#include "messagebox.h"
+#include "message_parser.h"
+#include "message_link.h"
+#include "crc32.h"
+
+
+/**
+ * @brief timed runs per case, the fastest one counts
+ */
+#define REPEATS		5
+
+
+/**
+ * @brief shortest timed run, in ns
+ */
+#define RUN_TIME	20000000ULL
+
+
+/**
+ * @brief frames in a synthetic stream
+ */
+#define STREAM_FRAMES	64
+
+
+/**
+ * @brief One workload, ops: how many times to run it.
+ */
+typedef void (*BenchRun_t)(void *context, uint32_t ops);
+
+
+/**
+ * @brief Synthetic byte stream and what parsing it has to yield.
+ */
+typedef struct BenchStream {
+	uint8_t data[STREAM_FRAMES * (sizeof(MessageFrame_t) + 16)];
+	uint32_t len; /**< @brief bytes in data */
+	uint32_t frames; /**< @brief valid frames in data */
+} BenchStream_t;
+
+
+/**
+ * @brief State of the message box and frame builder cases.
+ */
+typedef struct BenchPort {
+	MessageLink_t link;
+	Message_t slots[128];
+	Message_t message;
+	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE];
+	messagesize_t size;
+} BenchPort_t;
+
+
+static const uint8_t benchPreamble[MESSAGE_PREAMBLE_SIZE] = {0xAA, 0xBB, 0xCC, 0xDD};
+static uint8_t buffer[65536];
+static BenchStream_t stream;
+static BenchPort_t bench;
+static volatile uint32_t sink;
+static const char *filter;
+
+static uint64_t clockNs(void);
+static uint32_t random32(uint32_t*);
+static void fill(uint8_t*, uint32_t, uint32_t);
+static void report(const char*, uint32_t, uint32_t, BenchRun_t, void*);
+static void discard(void*, const void*, uint32_t);
+static void idle(void*);
+static void portInit(MessageFraming_t);
+static void buildStream(MessageFraming_t, messagesize_t, uint32_t);
+static uint32_t feedAll(MessageParser_t*, const uint8_t*, uint32_t);
+
+
+static const MessageLinkOps_t benchOps = { .write = discard,
+											.waitIdle = idle,
+											.frameGap = idle };
+
+
+static void runCompute(void *context, uint32_t ops) {
+	uint32_t len = (uintptr_t)context;
+	crc32_t checksum = 0;
+
+	for (uint32_t i = 0; i < ops; i++) {
+		checksum ^= crc32_compute(buffer, len);
+	}
+
+	sink = checksum;
+}
+
+
+static void runConcat(void *context, uint32_t ops) {
+	uint32_t len = (uintptr_t)context;
+	crc32_t checksum = 0;
+
+	// each call waits for the last one, like a frame arriving in pieces
+	for (uint32_t i = 0; i < ops; i++) {
+		checksum = crc32_concat(checksum, buffer, len);
+	}
+
+	sink = checksum;
+}
+
+
+static void runParser(void *context, uint32_t ops) {
+	MessageParser_t *parser = &bench.link.parser;
+	uint32_t frames = 0;
+
+	(void)context;
+
+	for (uint32_t i = 0; i < ops; i++) {
+		frames += feedAll(parser, stream.data, stream.len);
+	}
+
+	sink = frames;
+}
+
+
+static void runReceive(void *context, uint32_t ops) {
+	MessageParser_t *parser = &bench.link.parser;
+	MessageBox_t *box = &bench.link.messageBox;
+
+	(void)context;
+
+	// parsed, checked, pushed and popped again
+	for (uint32_t i = 0; i < ops; i++) {
+		const uint8_t *data = stream.data;
+		uint32_t len = stream.len;
+
+		while (len) {
+			uint32_t n = message_parser_feed(parser, data, len);
+			const Message_t *message = message_parser_getMessage(parser);
+
+			if (message) {
+				messagebox_push(box, message);
+			}
+
+			data += n;
+			len -= n;
+		}
+
+		while (messagebox_pop(box, &bench.message) == 0) {
+			sink = bench.message.payloadSize;
+		}
+	}
+}
+
+
+static void runPushPop(void *context, uint32_t ops) {
+	MessageBox_t *box = &bench.link.messageBox;
+
+	(void)context;
+
+	for (uint32_t i = 0; i < ops; i++) {
+		messagebox_push(box, &bench.message);
+		messagebox_pop(box, &bench.message);
+	}
+
+	sink = bench.message.payloadSize;
+}
+
+
+static void runBurst(void *context, uint32_t ops) {
+	MessageBox_t *box = &bench.link.messageBox;
+	uint8_t burst = messagebox_getCapacity(box);
+
+	(void)context;
+
+	// a full box drained in one go, the way message_poll() leaves it
+	for (uint32_t i = 0; i < ops; i += burst) {
+		for (uint8_t j = 0; j < burst; j++) {
+			messagebox_push(box, &bench.message);
+		}
+
+		while (messagebox_pop(box, &bench.message) == 0) {
+			// drain
+		}
+	}
+
+	sink = bench.message.payloadSize;
+}
+
+
+static void runCreateFrame(void *context, uint32_t ops) {
+	uint32_t length = 0;
+
+	(void)context;
+
+	for (uint32_t i = 0; i < ops; i++) {
+		length += message_link_createFrame(&bench.link, benchPreamble, 0x12, 0x34,
+											bench.payload, bench.size);
+	}
+
+	sink = length;
+}
+
+
+int main(int argc, char **argv) {
+	static const uint32_t crcSizes[] = { 16, 64, 256, 1024, 4096, 65536 };
+	static const messagesize_t payloadSizes[] = { 8, MESSAGE_MAX_PAYLOAD_SIZE };
+	char name[64];
+
+	filter = (argc > 1) ? argv[1] : NULL;
+	fill(buffer, sizeof(buffer), 1);
+
+	printf("%-32s %8s %12s %12s %10s\n", "case", "bytes/op", "ns/op", "ops/s", "MB/s");
+
+	for (uint8_t i = 0; i < sizeof(crcSizes) / sizeof(crcSizes[0]); i++) {
+		snprintf(name, sizeof(name), "crc32_compute/%u", crcSizes[i]);
+		report(name, crcSizes[i], 1, runCompute, (void*)(uintptr_t)crcSizes[i]);
+	}
+
+	for (uint8_t i = 0; i < sizeof(crcSizes) / sizeof(crcSizes[0]); i++) {
+		snprintf(name, sizeof(name), "crc32_concat/%u", crcSizes[i]);
+		report(name, crcSizes[i], 1, runConcat, (void*)(uintptr_t)crcSizes[i]);
+	}
+
+	static const struct {
+		const char *name;
+		MessageFraming_t framing;
+		uint32_t noise;
+	} streams[] = {
+		{ "preamble", kMessageFramingPreamble, 0 },
+		{ "preamble+noise", kMessageFramingPreamble, 16 },
+		{ "cobs", kMessageFramingCOBS, 0 },
+	};
+
+	for (uint8_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+		for (uint8_t j = 0; j < sizeof(payloadSizes) / sizeof(payloadSizes[0]); j++) {
+			buildStream(streams[i].framing, payloadSizes[j], streams[i].noise);
+
+			// ops are frames, one run parses the whole stream
+			snprintf(name, sizeof(name), "parser/%s/%u",
+					streams[i].name, payloadSizes[j]);
+			report(name, stream.len / stream.frames, stream.frames, runParser, NULL);
+
+			snprintf(name, sizeof(name), "receive/%s/%u",
+					streams[i].name, payloadSizes[j]);
+			report(name, stream.len / stream.frames, stream.frames, runReceive, NULL);
+		}
+	}
+
+	for (uint8_t j = 0; j < sizeof(payloadSizes) / sizeof(payloadSizes[0]); j++) {
+		portInit(kMessageFramingPreamble);
+		bench.message.payloadSize = payloadSizes[j];
+
+		snprintf(name, sizeof(name), "messagebox/push+pop/%u", payloadSizes[j]);
+		report(name, payloadSizes[j], 1, runPushPop, NULL);
+
+		snprintf(name, sizeof(name), "messagebox/burst/%u", payloadSizes[j]);
+		report(name, payloadSizes[j], 1, runBurst, NULL);
+	}
+
+	static const struct {
+		const char *name;
+		MessageFraming_t framing;
+	} framings[] = {
+		{ "preamble", kMessageFramingPreamble },
+		{ "cobs", kMessageFramingCOBS },
+	};
+
+	for (uint8_t i = 0; i < sizeof(framings) / sizeof(framings[0]); i++) {
+		for (uint8_t j = 0; j < sizeof(payloadSizes) / sizeof(payloadSizes[0]); j++) {
+			portInit(framings[i].framing);
+			fill(bench.payload, payloadSizes[j], 2);
+			bench.size = payloadSizes[j];
+
+			snprintf(name, sizeof(name), "createFrame/%s/%u",
+					framings[i].name, payloadSizes[j]);
+			report(name, payloadSizes[j], 1, runCreateFrame, NULL);
+		}
+	}
+
+	return 0;
+}
+
+
+uint64_t clockNs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ * @brief xorshift32, the same data on every run.
+ */
+uint32_t random32(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+
+	return *state;
+}
+
+
+void fill(uint8_t *data, uint32_t len, uint32_t seed) {
+	for (uint32_t i = 0; i < len; i++) {
+		data[i] = (uint8_t)random32(&seed);
+	}
+}
+
+
+/**
+ * @brief time one case and print its line, unless filtered out.
+ *
+ * bytes and ops/s refer to one op, a run with ops = 1 does scale of them.
+ */
+void report(const char *name, 
+			uint32_t bytes, 
+			uint32_t scale, 
+			BenchRun_t run, 
+			void *context) 
+{
+	if (filter && strstr(name, filter) == NULL) {
+		return;
+	}
+
+	// runs that are too short only measure the clock
+	uint32_t ops = 1;
+	uint64_t elapsed;
+
+	for (;;) {
+		uint64_t start = clockNs();
+
+		run(context, ops);
+		elapsed = clockNs() - start;
+
+		if (elapsed >= RUN_TIME / 4 || ops >= (1U << 30)) {
+			break;
+		}
+
+		ops *= 2;
+	}
+
+	ops = (uint32_t)((double)ops * RUN_TIME / (elapsed ? elapsed : 1)) + 1;
+
+	uint64_t best = UINT64_MAX;
+
+	for (uint8_t i = 0; i < REPEATS; i++) {
+		uint64_t start = clockNs();
+
+		run(context, ops);
+		elapsed = clockNs() - start;
+
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	double ns = (double)best / ((double)ops * scale);
+
+	printf("%-32s %8u %12.1f %12.0f %10.1f\n",
+			name, bytes, ns, 1e9 / ns, bytes * 1e3 / ns);
+}
+
+
+/**
+ * @brief the line of the bench port, nothing is sent.
+ */
+void discard(void *port, const void *data, uint32_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+}
+
+
+void idle(void *port) {
+	(void)port;
+}
+
+
+/**
+ * @brief a link without a line: parser, box and frame builder only.
+ */
+void portInit(MessageFraming_t framing) {
+	message_link_init(&bench.link, bench.slots,
+					sizeof(bench.slots) / sizeof(bench.slots[0]), &benchOps);
+	message_parser_setPreamble(&bench.link.parser, benchPreamble);
+	message_parser_setFraming(&bench.link.parser, framing);
+}
+
+
+/**
+ * @brief STREAM_FRAMES frames built by message_link_createFrame(), noise bytes of
+ * random data in front of each.
+ */
+void buildStream(MessageFraming_t framing, messagesize_t size, uint32_t noise) {
+	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE];
+	uint32_t seed = 3;
+
+	portInit(framing);
+	stream.len = 0;
+
+	for (uint32_t i = 0; i < STREAM_FRAMES; i++) {
+		for (uint32_t j = 0; j < noise; j++) {
+			// never the first preamble byte (nor a COBS delimiter), so
+			// the noise cannot hide a frame
+			uint8_t byte = (uint8_t)random32(&seed);
+
+			stream.data[stream.len++] = (byte == benchPreamble[0] || byte == 0) ?
+										0x55 : byte;
+		}
+
+		fill(payload, size, seed + i);
+
+		uint16_t length = message_link_createFrame(&bench.link, benchPreamble,
+													0x12, 0x34, payload, size);
+
+		memcpy(stream.data + stream.len, &bench.link.txFrame, length);
+		stream.len += length;
+	}
+
+	stream.frames = feedAll(&bench.link.parser, stream.data, stream.len);
+
+	if (stream.frames != STREAM_FRAMES) {
+		fprintf(stderr, "stream of %u frames parsed as %u\n",
+				STREAM_FRAMES, stream.frames);
+		exit(1);
+	}
+}
+
+
+/**
+ * @brief run the parser over a buffer, count the frames it yields.
+ */
+uint32_t feedAll(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	uint32_t frames = 0;
+
+	while (len) {
+		uint32_t n = message_parser_feed(parser, data, len);
+
+		if (message_parser_getMessage(parser)) {
+			frames++;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return frames;
+}
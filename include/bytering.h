@@ -0,0 +1,89 @@
+/**
+ * @file bytering.h
+ * @brief Function prototypes for a lock-free single-producer/single-consumer
+ * byte ring.
+ *
+ * The producer (usually the RX interrupt) only calls bytering_push(), the
+ * consumer (main loop or task) only calls bytering_pop(). Both indexes are
+ * free-running and each is written by one side only, so no lock and no
+ * interrupt masking is needed.
+ */
+
+
+#ifndef __BYTERING__
+#define __BYTERING__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/**
+ * @brief index type, loaded and stored in a single access on the target.
+ *
+ * AVR has no atomic 16-bit access, so its ring holds at most 128 bytes.
+ */
+#ifdef __AVR__
+typedef uint8_t ringindex_t;
+#else
+typedef uint16_t ringindex_t;
+#endif
+
+
+/**
+ * @brief Struct contains a byte ring.
+ */
+typedef struct ByteRing {
+	uint8_t *data; /**< @brief storage, power-of-two size */
+	ringindex_t mask; /**< @brief size - 1 */
+	ringindex_t head; /**< @brief free-running write count, producer only */
+	ringindex_t tail; /**< @brief free-running read count, consumer only */
+} ByteRing_t;
+
+
+/**
+ * @brief Initialize a byte ring on user-provided storage.
+ * @param ring ring instance.
+ * @param data storage array.
+ * @param size size of storage, a power of two, at most half the range of
+ * ringindex_t.
+ * @return nothing.
+ */
+void bytering_init(ByteRing_t *ring, uint8_t *data, ringindex_t size);
+
+
+/**
+ * @brief Append one byte (producer side).
+ * @param ring ring instance.
+ * @param byte new byte.
+ * @return true: OK, false: ring is full and the byte is dropped.
+ */
+bool bytering_push(ByteRing_t *ring, uint8_t byte);
+
+
+/**
+ * @brief Take out up to len bytes (consumer side).
+ * @param ring ring instance.
+ * @param buffer destination array.
+ * @param len size of destination in byte.
+ * @return the number of bytes copied.
+ */
+ringindex_t bytering_pop(ByteRing_t *ring, uint8_t *buffer, ringindex_t len);
+
+
+/**
+ * @brief Check if ring is empty (consumer side).
+ * @param ring ring instance.
+ * @return state of ring.
+ */
+bool bytering_isEmpty(ByteRing_t *ring);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BYTERING__ */
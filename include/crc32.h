@@ -41,6 +41,55 @@ crc32_t crc32_compute(const void* data, uint32_t len);
 crc32_t crc32_concat(crc32_t checksum, const void* data, uint32_t len);
 
 
+/** 
+ * @brief append one byte to an existing CRC-32 checksum value.
+ *
+ * Same result as crc32_concat(checksum, &data, 1), without the loop, so a
+ * receiver can checksum each byte as it arrives.
+ *
+ * @param checksum existing checksum value, 0 for empty data.
+ * @param data new data byte.
+ * @return CRC-32 checksum value.
+ */
+crc32_t crc32_concatByte(crc32_t checksum, uint8_t data);
+
+
+/** 
+ * @brief compute CRC-32 checksum of A followed by B from their checksums.
+ *
+ * Runs in O(log lenB) without touching the data, so both parts can be
+ * checksummed separately (or cached) and merged later.
+ *
+ * @param crcA CRC-32 checksum value of the first part.
+ * @param crcB CRC-32 checksum value of the second part.
+ * @param lenB the length of the second part in byte.
+ * @return CRC-32 checksum value of the whole.
+ */
+crc32_t crc32_combine(crc32_t crcA, crc32_t crcB, uint32_t lenB);
+
+
+/** 
+ * @brief precompute the operator of crc32_combine() for a fixed length.
+ * @param lenB the length of the second part in byte.
+ * @return operator for crc32_combine_op().
+ */
+crc32_t crc32_combine_gen(uint32_t lenB);
+
+
+/** 
+ * @brief crc32_combine() with an operator from crc32_combine_gen().
+ *
+ * A single multiplication, cheaper than checksumming even a short second
+ * part when the same length is combined many times.
+ *
+ * @param crcA CRC-32 checksum value of the first part.
+ * @param crcB CRC-32 checksum value of the second part.
+ * @param op operator returned by crc32_combine_gen(lenB).
+ * @return CRC-32 checksum value of the whole.
+ */
+crc32_t crc32_combine_op(crc32_t crcA, crc32_t crcB, crc32_t op);
+
+
 /** 
  * @brief check the accuracy of computed CRC-32 checksum value.
  * @param data pointer to an array;
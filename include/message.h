@@ -24,9 +24,89 @@ extern "C" {
 #include <stdint.h>
 
 /** 
- * @brief maximum payload size
+ * @brief maximum payload size of one frame
+ *
+ * Up to 127 the length field is 1 byte, above it (up to 32767) 2 bytes.
+ * message_send() splits longer payloads into several frames.
  */     
+#ifndef MESSAGE_MAX_PAYLOAD_SIZE
 #define MESSAGE_MAX_PAYLOAD_SIZE    64
+#endif
+
+#if MESSAGE_MAX_PAYLOAD_SIZE <= 4 || MESSAGE_MAX_PAYLOAD_SIZE > 0x7FFF
+#error "MESSAGE_MAX_PAYLOAD_SIZE must be within 5..32767"
+#endif
+
+
+/** 
+ * @brief datatype for the length field of a frame
+ *
+ * Sent little-endian. The top bit marks a payload starting with a flags
+ * byte (Message_t::flags), the other bits count that byte as well.
+ * Define MESSAGE_LENGTH_16BIT to use 2 bytes for small frames as well.
+ */
+#if MESSAGE_MAX_PAYLOAD_SIZE > 0x7F || MESSAGE_LENGTH_16BIT
+typedef uint16_t messagesize_t;
+#else
+typedef uint8_t messagesize_t;
+#endif
+
+
+/** 
+ * @brief Message_t::flags bit of a fragment, see message_fragment.h
+ */
+#define MESSAGE_FRAGMENT    0x01
+
+
+/** 
+ * @brief Message_t::flags bit of an aggregate, see message_aggregate.h
+ *
+ * Never seen by the application, the receiver unpacks aggregates into
+ * separate messages.
+ */
+#define MESSAGE_AGGREGATE   0x02
+
+
+/** 
+ * @brief Message_t::flags bit of a reliable frame, see message_reliable.h
+ */
+#define MESSAGE_RELIABLE    0x04
+
+
+/** 
+ * @brief Message_t::flags bit of an acknowledgement, see message_reliable.h
+ *
+ * Never seen by the application, like MESSAGE_AGGREGATE.
+ */
+#define MESSAGE_ACK         0x08
+
+
+/** 
+ * @brief Message_t::flags bit of a NAK: a full box rejected a message
+ *
+ * Sent back to the source by message_poll(), handed to the NAK handler of
+ * the port instead of the message box (see messageport_setNakHandler()).
+ */
+#define MESSAGE_NAK         0x40
+
+
+/** 
+ * @brief Message_t::flags bits of the priority class, 0 (default) to 3
+ *
+ * Pick the lane of a message box with priority lanes, see
+ * messagebox_setLanes(). Send them with messageport_sendFlagged().
+ */
+#define MESSAGE_PRIORITY_MASK   0x30
+#define MESSAGE_PRIORITY_SHIFT  4
+#define MESSAGE_PRIORITY(n)     (((n) << MESSAGE_PRIORITY_SHIFT) & MESSAGE_PRIORITY_MASK)
+
+
+/** 
+ * @brief destination address taken by every node
+ */
+#ifndef MESSAGE_BROADCAST
+#define MESSAGE_BROADCAST   0xFF
+#endif
 
 
 /** 
@@ -35,6 +115,158 @@ extern "C" {
 #define MESSAGE_PREAMBLE_SIZE   4
 
 
+/** 
+ * @brief size of the raw byte ring in deferred mode (power of two)
+ *
+ * With MESSAGE_DEFERRED set, the RX interrupt only stores bytes here and
+ * message_poll() parses them. At most 128 on AVR.
+ */
+#ifndef MESSAGE_RX_RING_SIZE
+#define MESSAGE_RX_RING_SIZE    64
+#endif
+
+
+/** 
+ * @brief line timeouts and address characters message_poll() may lag
+ * behind (power of two)
+ *
+ * In deferred mode each of them is queued with its ring position and
+ * drops the frame there. One more before message_poll() catches up is
+ * lost, its frame then fails the checksum instead.
+ */
+#ifndef MESSAGE_RX_TIMEOUT_QUEUE
+#define MESSAGE_RX_TIMEOUT_QUEUE    4
+#endif
+
+
+/** 
+ * @brief idle time between two frames, in character times
+ *
+ * Converted to a delay from the baudrate of the port (10 bits per
+ * character, 8N1).
+ */
+#ifndef MESSAGE_FRAME_GAP
+#define MESSAGE_FRAME_GAP   4
+#endif
+
+
+/** 
+ * @brief idle time inside a frame that drops it, in character times
+ *
+ * A lost byte would otherwise make the parser take the start of the next
+ * frame as the rest of this one. Measured with message_tick() (AVR,
+ * Tiva) or the monotonic clock on a tty (host); 0 disables it.
+ */
+#ifndef MESSAGE_RX_TIMEOUT
+#define MESSAGE_RX_TIMEOUT  3
+#endif
+
+
+/** 
+ * @brief rate of message_tick() on AVR and Tiva, in Hz
+ *
+ * The line timeout is rounded up to whole periods, a slow tick makes it
+ * longer than MESSAGE_RX_TIMEOUT on fast lines.
+ */
+#ifndef MESSAGE_TICK_RATE
+#define MESSAGE_TICK_RATE   10000
+#endif
+
+
+/** 
+ * @brief let the library drive SysTick for the line timeout (Tiva)
+ *
+ * Off by default: SysTick belongs to the application or its RTOS, which
+ * calls message_tick() at MESSAGE_TICK_RATE from its own timer handler.
+ * With 1, opening a port programs SysTick and installs message_tick() as
+ * its handler.
+ */
+#ifndef MESSAGE_SYSTICK
+#define MESSAGE_SYSTICK     0
+#endif
+
+
+/** 
+ * @brief let the library drive Timer2 for the line timeout (AVR)
+ *
+ * Off by default: the timers belong to the application, which calls
+ * message_tick() at MESSAGE_TICK_RATE. With 1, opening the port programs
+ * Timer2 in CTC mode and takes its compare interrupt; message_tick() is
+ * not built then.
+ */
+#ifndef MESSAGE_TIMER2
+#define MESSAGE_TIMER2      0
+#endif
+
+
+/** 
+ * @brief let the library run Timer1 for the ISR histogram (AVR)
+ *
+ * Off by default: the histogram reads TCNT1 as the application runs
+ * Timer1, its bins count that timer's ticks. With 1, opening the port
+ * starts Timer1 free-running at F_CPU.
+ */
+#ifndef MESSAGE_TIMER1
+#define MESSAGE_TIMER1      0
+#endif
+
+
+/** 
+ * @brief keep link statistics, see message_getStats()
+ *
+ * Off by default: the counters, their updates and the API are compiled
+ * out completely.
+ */
+#ifndef MESSAGE_STATS
+#define MESSAGE_STATS   0
+#endif
+
+
+/** 
+ * @brief time the receive interrupt into a histogram (needs MESSAGE_STATS)
+ *
+ * Measured in ticks of Timer1 (AVR, see MESSAGE_TIMER1), in CPU cycles
+ * with the DWT cycle counter (Tiva), in ns with the monotonic clock
+ * around each event of the receiver thread (host).
+ */
+#ifndef MESSAGE_ISR_HISTOGRAM
+#define MESSAGE_ISR_HISTOGRAM   0
+#endif
+
+#if MESSAGE_ISR_HISTOGRAM && !MESSAGE_STATS
+#error "MESSAGE_ISR_HISTOGRAM needs MESSAGE_STATS"
+#endif
+
+
+/** 
+ * @brief bins of the ISR histogram, bin i counts 2^i to 2^(i+1) - 1
+ */
+#ifndef MESSAGE_HISTOGRAM_BINS
+#define MESSAGE_HISTOGRAM_BINS  16
+#endif
+
+
+/** 
+ * @brief number of links that can be open at the same time
+ *
+ * Each port keeps its own parser, preamble, message box and TX state.
+ * AVR only drives USART0 and always has one port.
+ */
+#ifndef MESSAGE_MAX_PORTS
+#define MESSAGE_MAX_PORTS   1
+#endif
+
+
+/** 
+ * @brief Tiva build, set by CMake with SERIES TIVA
+ *
+ * A Tiva port is opened with its UART base address and baudrate.
+ */
+#ifndef MESSAGE_TIVA
+#define MESSAGE_TIVA    0
+#endif
+
+
 /**
  * @brief Abstract datatype of struct MessageBox.
  *
@@ -43,34 +275,123 @@ extern "C" {
 typedef void * MessageBoxHandle_t;
 
 
+/**
+ * @brief Abstract datatype of struct MessagePort, one link.
+ */
+typedef void * MessagePortHandle_t;
+
+
 /** 
  * @brief Struct contains message payload
  */  
 typedef struct Message {
     uint8_t address; /**< @brief source address: 1 bytes*/
-    uint8_t payloadSize; /**< @brief size of payload: 1 byte */
+    uint8_t destination; /**< @brief destination address: 1 byte */
+    uint8_t flags; /**< @brief MESSAGE_* bits, 0 for a plain frame */
+    messagesize_t payloadSize; /**< @brief size of payload */
     uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE]; /**< @brief payload */
 } __attribute__((packed)) Message_t;
 
 
+/** 
+ * @brief One piece of a payload for message_sendv()
+ */  
+typedef struct MessageSegment {
+    const void *data; /**< @brief pointer to the piece */
+    messagesize_t len; /**< @brief length of the piece in byte */
+} MessageSegment_t;
+
+
+#if MESSAGE_STATS
+/** 
+ * @brief Counters of one link since it was opened
+ *
+ * Counters wrap around. They are updated by the receive path while they
+ * are read, so they only roughly agree with each other.
+ */  
+typedef struct MessageStats {
+    uint32_t rxBytes; /**< @brief bytes handed to the parser */
+    uint32_t rxFrames; /**< @brief frames with a valid checksum */
+    uint32_t txFrames; /**< @brief frames sent, fragments counted one by one */
+    uint16_t crcErrors; /**< @brief frames with a bad checksum */
+    uint16_t resyncs; /**< @brief preambles found after noise, dropped partial frames */
+    uint16_t truncated; /**< @brief frames cut to MESSAGE_MAX_PAYLOAD_SIZE */
+    uint16_t filtered; /**< @brief frames for other nodes, skipped */
+    uint16_t overruns; /**< @brief bytes lost before the parser: UART, RX ring */
+    uint16_t dropped; /**< @brief messages lost to a full box */
+    uint16_t overwritten; /**< @brief old messages replaced in a full box */
+    uint16_t rejected; /**< @brief messages refused with a NAK */
+    uint8_t boxHighWater; /**< @brief most messages in one lane at a time */
+#if MESSAGE_ISR_HISTOGRAM
+    uint16_t isrTime[MESSAGE_HISTOGRAM_BINS]; /**< @brief ISR runs by duration */
+#endif
+} MessageStats_t;
+#endif
+
+
+/** 
+ * @brief Wire format of a port
+ */  
+typedef enum MessageFraming {
+    kMessageFramingPreamble = 0, /**< @brief preamble, then the frame */
+    kMessageFramingCOBS, /**< @brief COBS-encoded frame ended by 0x00, see message_cobs.h */
+    kMessageFramingAddress /**< @brief no preamble, destination sent with the 9th bit set */
+} MessageFraming_t;
+
+
+/** 
+ * @brief Callback for a finished message_sendAsync(), runs in ISR context
+ */
+typedef void (*MessageSendCallback_t)(MessagePortHandle_t port);
+
+
+/** 
+ * @brief Callback for a received NAK, runs in the receive path
+ *
+ * address is the node that rejected a message, the sender should back
+ * off before it sends to it again.
+ */
+typedef void (*MessageNakCallback_t)(MessagePortHandle_t port, uint8_t address);
+
+
 /** 
  * @brief Create message box
  * 
- * Open UART bus, initialize crc32 checksum, enable interrupt.
+ * Open UART bus, initialize crc32 checksum, enable interrupt. The port
+ * becomes the default port of message_send() and the other functions
+ * without a port argument.
  *
- * @param baudrate UART baudrate.
+ * @param base UART base address (Tiva only).
+ * @param baudrate UART baudrate (AVR, Tiva) or file descriptor (host).
+ * A tty keeps the speed it was configured with, the frame gap and line
+ * timeout follow it.
  * @param data an array of Message_t.
  * @param num max size of FIFO buffer.
- * @return pointer to received MessageFrame.
+ * @return pointer to received MessageFrame, NULL for a base address
+ * that is no UART or a baudrate of 0 (Tiva) or on failure (host).
  */
+#if MESSAGE_TIVA
+MessageBoxHandle_t uart_messagebox_create(uint32_t base,
+                                        uint32_t baudrate,
+                                        Message_t *data,
+                                        uint8_t num);
+#else
 MessageBoxHandle_t uart_messagebox_create(uint32_t baudrate, 
                                         Message_t *data,
                                         uint8_t num);
+#endif
 
 
 /** 
  * @brief Send message frame
  *
+ * Waits for a frame from message_sendAsync() to finish, sends the frame
+ * and keeps the line idle for MESSAGE_FRAME_GAP characters.
+ *
+ * A payload longer than MESSAGE_MAX_PAYLOAD_SIZE is sent as back-to-back
+ * fragments, with one gap after the last. The receiver puts them back
+ * together with message_reassemble().
+ *
  * @param preamble UART baudrate.
  * @param destination Receiver's address.
  * @param source Transmitter's address.
@@ -82,12 +403,79 @@ void message_send(const void* preamble,
                         uint8_t destination, 
                         uint8_t source, 
                         const void* payload, 
-                        uint8_t len);
+                        uint16_t len);
+
+
+/** 
+ * @brief Send message frame with a payload made of several pieces
+ *
+ * The pieces are checksummed and sent where they are, without copying
+ * them into a frame buffer first. The payload is truncated to
+ * MESSAGE_MAX_PAYLOAD_SIZE, it is never split into fragments.
+ *
+ * @param preamble 4-byte frame preamble.
+ * @param destination Receiver's address.
+ * @param source Transmitter's address.
+ * @param segs array of payload pieces, sent in order.
+ * @param n number of pieces.
+ * @return nothing.
+ */
+void message_sendv(const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        const MessageSegment_t *segs, 
+                        uint8_t n);
+
+
+/** 
+ * @brief Send message frame without waiting
+ *
+ * The frame is built in the transmit buffer and handed to the UDRE
+ * interrupt (AVR), µDMA (Tiva) or the receiver thread (host). The function
+ * returns right away, the payload can be reused as soon as it returns.
+ * On Tiva the end of the µDMA transfer starts a MESSAGE_FRAME_GAP: done
+ * runs right away, but message_isSending() stays true and the next call
+ * returns -1 until it is over. The other ports add no gap, receivers
+ * checksum while bytes arrive and do not need one.
+ * In address mode on Tiva the address character goes out before the
+ * function returns, blocking for one character time; the µDMA cannot
+ * switch the 9th bit.
+ * On Tiva the application must enable uDMA and set its control table
+ * (uDMAEnable(), uDMAControlBaseSet()) first; the first call on a port
+ * sets up its TX channel. Blocking sends never touch uDMA.
+ *
+ * On a COBS port the frame is encoded in the transmit buffer, which needs
+ * MESSAGE_MAX_PAYLOAD_SIZE up to 1000.
+ *
+ * @param preamble 4-byte frame preamble.
+ * @param destination Receiver's address.
+ * @param source Transmitter's address.
+ * @param payload message need to be sent.
+ * @param len length of message. 
+ * @param done called when the last bit is on the line, may be NULL.
+ * @return 0: queued, -1: previous frame is still being sent or the frame
+ * does not fit the transmit buffer.
+ */
+int message_sendAsync(const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        const void* payload, 
+                        messagesize_t len,
+                        MessageSendCallback_t done);
+
+
+/** 
+ * @brief Check if a frame from message_sendAsync() is still being sent
+ * @return true while transmitting, on Tiva also during the frame gap.
+ */
+bool message_isSending(void);
 
 
 /** 
  * @brief Set valid preamble (4 bytes) for incoming frame
  *
+ * Applies to the default port and to every port opened afterwards.
+ *
  * @param b1 first byte.
  * @param b2 second byte.
  * @param b3 third byte.
@@ -97,6 +485,235 @@ void message_send(const void* preamble,
 void message_setPreamble(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4);
 
 
+/** 
+ * @brief Select the wire format for both directions
+ *
+ * Applies to the default port and to every port opened afterwards. In COBS
+ * and address mode the preamble arguments of the send functions are
+ * ignored. Both ends of a link must use the same format.
+ *
+ * kMessageFramingAddress runs the UART with 9 data bits (multi-processor
+ * mode): only the destination byte has the 9th bit set, and receivers
+ * ignore the rest of a frame for another node in hardware (MPCM on AVR,
+ * address match on Tiva; the host has no 9th bit and sends the same
+ * bytes 8N1). On AVR the filter is armed again at the end of each frame,
+ * in deferred mode by the line timeout (MESSAGE_RX_TIMEOUT). The Tiva
+ * hardware compares one address and mask, so it also lets through some
+ * addresses next to MESSAGE_BROADCAST, which the parser skips.
+ *
+ * @param framing kMessageFramingPreamble (default), kMessageFramingCOBS or
+ * kMessageFramingAddress.
+ * @return nothing.
+ */
+void message_setFraming(MessageFraming_t framing);
+
+
+/** 
+ * @brief Set the address of this node for incoming frames
+ *
+ * Frames go to the message box if their destination is MESSAGE_BROADCAST
+ * or equals address in every bit set in mask; the rest is skipped right
+ * behind the header, without copying or checksumming the payload. With
+ * mask 0xF0, address 0x12 takes 0x10..0x1F as a multicast group.
+ * Applies to the default port and to every port opened afterwards.
+ *
+ * @param address own address.
+ * @param mask 0xFF: address only, 0x00 (default): every frame.
+ * @return nothing.
+ */
+void message_setAddress(uint8_t address, uint8_t mask);
+
+
+/** 
+ * @brief Set the handler of received NAKs
+ *
+ * Applies to the default port and to every port opened afterwards.
+ *
+ * @param handler called with the address of the rejecting node, NULL
+ * ignores NAKs.
+ * @return nothing.
+ */
+void message_setNakHandler(MessageNakCallback_t handler);
+
+
+/** 
+ * @brief Parse received bytes in task context (deferred mode)
+ *
+ * Runs the frame parser over everything the RX interrupt stored since the
+ * last call and pushes complete messages into the message box, for every
+ * open port. Call it from the main loop. Without MESSAGE_DEFERRED it only
+ * sends the NAKs of boxes set to kMessageOverflowReject, see
+ * messagebox_setOverflow().
+ *
+ * @return the number of bytes parsed.
+ */
+uint32_t message_poll(void);
+
+
+#if MESSAGE_RX_TIMEOUT
+/** 
+ * @brief Count down the line timeouts of all ports (AVR, Tiva)
+ *
+ * Call it at MESSAGE_TICK_RATE from a timer interrupt, unless
+ * MESSAGE_TIMER2 (AVR) or MESSAGE_SYSTICK (Tiva) lets the library use a
+ * timer of its own. Without it frames are never dropped for an idle line.
+ * Any interrupt priority will do: on Tiva the frame is dropped by the
+ * UART interrupt, which message_tick() pends.
+ *
+ * @return nothing.
+ */
+void message_tick(void);
+#endif
+
+
+#if MESSAGE_STATS
+/** 
+ * @brief Get the statistics of the default port
+ *
+ * Overflow counters are those of the message box, its lanes included; the
+ * high-water mark is sampled after each received frame.
+ *
+ * @param stats copy of the counters.
+ * @return nothing.
+ */
+void message_getStats(MessageStats_t *stats);
+#endif
+
+
+/** 
+ * @brief Open one link
+ *
+ * Same as uart_messagebox_create() for a single UART, but several ports
+ * (up to MESSAGE_MAX_PORTS) can run side by side, each with its own
+ * parser state, preamble, message box and transmit state. Opening the
+ * same UART again resets its port.
+ *
+ * @param base UART baudrate (AVR), UART base address (Tiva) or
+ * file descriptor (host).
+ * @param baudrate UART baudrate (Tiva only).
+ * @param data an array of Message_t.
+ * @param num max size of FIFO buffer.
+ * @return new port, NULL if all ports are in use, for a base address
+ * that is no UART or a baudrate of 0 (Tiva) or on failure (host).
+ */
+#if MESSAGE_TIVA
+MessagePortHandle_t uart_messageport_create(uint32_t base,
+                                        uint32_t baudrate,
+                                        Message_t *data,
+                                        uint8_t num);
+#else
+MessagePortHandle_t uart_messageport_create(uint32_t base, 
+                                        Message_t *data,
+                                        uint8_t num);
+#endif
+
+
+/** 
+ * @brief Get the box receiving the messages of a port
+ * @param port port instance.
+ * @return message box of the port.
+ */
+MessageBoxHandle_t messageport_getBox(MessagePortHandle_t port);
+
+
+/** 
+ * @brief message_setPreamble() for one port
+ */
+void messageport_setPreamble(MessagePortHandle_t port,
+                            uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4);
+
+
+/** 
+ * @brief message_setFraming() for one port
+ */
+void messageport_setFraming(MessagePortHandle_t port, MessageFraming_t framing);
+
+
+/** 
+ * @brief message_setAddress() for one port
+ */
+void messageport_setAddress(MessagePortHandle_t port, 
+                            uint8_t address, 
+                            uint8_t mask);
+
+
+/** 
+ * @brief message_setNakHandler() for one port
+ */
+void messageport_setNakHandler(MessagePortHandle_t port, MessageNakCallback_t handler);
+
+
+/** 
+ * @brief message_send() on one port
+ */
+void messageport_send(MessagePortHandle_t port,
+                        const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        const void* payload, 
+                        uint16_t len);
+
+
+/** 
+ * @brief message_sendv() on one port
+ */
+void messageport_sendv(MessagePortHandle_t port,
+                        const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        const MessageSegment_t *segs, 
+                        uint8_t n);
+
+
+/** 
+ * @brief message_sendv() on one port, with a flags byte in the frame
+ *
+ * Used by the layers on top of the protocol (fragments, aggregates). The
+ * flags byte costs one payload byte; 0 sends a plain frame.
+ *
+ * @param flags MESSAGE_* bits received in Message_t::flags.
+ */
+void messageport_sendFlagged(MessagePortHandle_t port,
+                        const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        uint8_t flags,
+                        const MessageSegment_t *segs, 
+                        uint8_t n);
+
+
+/** 
+ * @brief message_sendAsync() on one port
+ */
+int messageport_sendAsync(MessagePortHandle_t port,
+                        const void* preamble, 
+                        uint8_t destination, 
+                        uint8_t source, 
+                        const void* payload, 
+                        messagesize_t len,
+                        MessageSendCallback_t done);
+
+
+/** 
+ * @brief message_isSending() for one port
+ */
+bool messageport_isSending(MessagePortHandle_t port);
+
+
+/** 
+ * @brief message_poll() for one port
+ */
+uint32_t messageport_poll(MessagePortHandle_t port);
+
+
+#if MESSAGE_STATS
+/** 
+ * @brief message_getStats() for one port
+ */
+void messageport_getStats(MessagePortHandle_t port, MessageStats_t *stats);
+#endif
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,134 @@
+/** 
+ * @file message_aggregate.h
+ * @brief Function prototypes for coalescing small messages into one frame
+ *
+ * An aggregator collects messages for one destination and sends them as
+ * a single frame flagged MESSAGE_AGGREGATE, when the queued bytes reach a
+ * threshold or the oldest one reaches a deadline. The payload is a list
+ * of entries, each one length byte followed by the message. The receiver
+ * unpacks them into separate Message_t in its message box, with the same
+ * source address.
+ */
+
+
+#ifndef __MESSAGE_AGGREGATE__
+#define __MESSAGE_AGGREGATE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "message.h"
+#include "messagebox.h"
+
+
+/** 
+ * @brief entry bytes one aggregate can carry (behind the flags byte)
+ */
+#define MESSAGE_AGGREGATE_SIZE  (MESSAGE_MAX_PAYLOAD_SIZE - 1)
+
+
+/** 
+ * @brief Struct contains the messages waiting for one aggregate frame.
+ */ 
+typedef struct MessageAggregator {
+	MessagePortHandle_t port; /**< @brief link the frames go to */
+	uint16_t threshold; /**< @brief queued bytes that trigger a flush */
+	uint32_t deadline; /**< @brief longest wait of a message, in time units */
+	uint32_t since; /**< @brief time the oldest message was queued */
+	uint8_t preamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief preamble of the frame */
+	uint8_t destination; /**< @brief destination of the queued messages */
+	uint8_t source; /**< @brief source of the queued messages */
+	uint8_t count; /**< @brief number of queued messages */
+	uint16_t length; /**< @brief bytes used in buffer */
+	uint8_t buffer[MESSAGE_AGGREGATE_SIZE]; /**< @brief queued entries */
+} MessageAggregator_t;
+
+
+/**
+ * @brief Initialize an aggregator.
+ *
+ * Time is whatever unit the caller passes to message_aggregate() and
+ * message_aggregator_poll(): milliseconds, timer ticks,...
+ *
+ * @param aggregator aggregator instance.
+ * @param port link the frames are sent to.
+ * @param threshold queued bytes that trigger a flush, at most
+ * MESSAGE_AGGREGATE_SIZE.
+ * @param deadline longest time a message may wait.
+ * @return nothing.
+ */
+void message_aggregator_init(MessageAggregator_t *aggregator,
+							MessagePortHandle_t port,
+							uint16_t threshold,
+							uint32_t deadline);
+
+
+/**
+ * @brief Queue one message.
+ *
+ * Messages for another destination, source or preamble flush the queue
+ * first. A message too long for an aggregate is sent right away with
+ * messageport_send(), after the queue.
+ *
+ * @param aggregator aggregator instance.
+ * @param preamble 4-byte frame preamble.
+ * @param destination Receiver's address.
+ * @param source Transmitter's address.
+ * @param payload message need to be sent.
+ * @param len length of message.
+ * @param now current time.
+ * @return nothing.
+ */
+void message_aggregate(MessageAggregator_t *aggregator,
+						const void *preamble,
+						uint8_t destination,
+						uint8_t source,
+						const void *payload,
+						uint16_t len,
+						uint32_t now);
+
+
+/**
+ * @brief Flush the queue if its oldest message reached the deadline.
+ *
+ * Call it periodically, e.g. next to message_poll().
+ *
+ * @param aggregator aggregator instance.
+ * @param now current time.
+ * @return nothing.
+ */
+void message_aggregator_poll(MessageAggregator_t *aggregator, uint32_t now);
+
+
+/**
+ * @brief Send the queued messages now.
+ *
+ * A single queued message goes out as a plain frame.
+ *
+ * @param aggregator aggregator instance.
+ * @return nothing.
+ */
+void message_aggregator_flush(MessageAggregator_t *aggregator);
+
+
+/**
+ * @brief Push the entries of a received aggregate into a message box.
+ *
+ * Called by the receive path. Entries arriving at a full lane go through
+ * its overflow policy and counters like any other message.
+ *
+ * @param aggregate received message flagged MESSAGE_AGGREGATE.
+ * @param box destination message box.
+ * @return the number of messages pushed.
+ */
+uint8_t message_unpack(const Message_t *aggregate, MessageBox_t *box);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_AGGREGATE__ */
@@ -0,0 +1,88 @@
+/**
+ * @file message_cobs.h
+ * @brief Function prototypes for the COBS wire format
+ *
+ * A port set to kMessageFramingCOBS sends every frame without preamble,
+ * Consistent Overhead Byte Stuffing encoded and ended by a 0x00 byte.
+ * The encoded frame never holds a 0x00, so a receiver resynchronises on
+ * the next one, and the overhead is at most 1 byte per 254. The checksum
+ * covers address, length, payload as before, minus the preamble.
+ */
+
+
+#ifndef __MESSAGE_COBS__
+#define __MESSAGE_COBS__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "message.h"
+
+
+/**
+ * @brief byte ending each encoded frame
+ */
+#define MESSAGE_COBS_DELIMITER  0x00
+
+
+/**
+ * @brief longest run of non-zero bytes in one block
+ */
+#define MESSAGE_COBS_BLOCK_SIZE 254
+
+
+/**
+ * @brief Puts encoded bytes on the line.
+ */
+typedef void (*MessageWrite_t)(void *context, const void *data, uint32_t len);
+
+
+/**
+ * @brief Encode a frame made of several pieces and write it out.
+ *
+ * The pieces are read where they are and written in runs, only the block
+ * lengths are looked up ahead. The delimiter is written last.
+ *
+ * @param head first piece (address and length field).
+ * @param segs payload pieces.
+ * @param n number of payload pieces.
+ * @param size payload bytes taken from segs, the rest is cut.
+ * @param tail last piece (checksum).
+ * @param write output function.
+ * @param context passed to write.
+ * @return nothing.
+ */
+void message_cobs_encode(const MessageSegment_t *head,
+						const MessageSegment_t *segs,
+						uint8_t n,
+						uint16_t size,
+						const MessageSegment_t *tail,
+						MessageWrite_t write,
+						void *context);
+
+
+/**
+ * @brief Encode a frame in its own buffer, delimiter included.
+ *
+ * The frame starts offset bytes into the buffer, the encoded frame starts
+ * at the beginning and is at most offset + 1 bytes longer than the frame
+ * itself, so the buffer must hold offset + len + 1 bytes.
+ *
+ * @param buffer frame storage.
+ * @param offset free bytes in front of the frame, at least 1 + len / 254.
+ * @param len length of the frame in byte.
+ * @return length of the encoded frame, 0 if offset is too small.
+ */
+uint16_t message_cobs_encodeInPlace(uint8_t *buffer,
+									uint16_t offset,
+									uint16_t len);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_COBS__ */
@@ -0,0 +1,81 @@
+/** 
+ * @file message_fragment.h
+ * @brief Function prototypes for putting fragmented payloads back together
+ *
+ * message_send() splits a payload longer than MESSAGE_MAX_PAYLOAD_SIZE
+ * into frames flagged MESSAGE_FRAGMENT. Each piece has a 4-byte header,
+ * total length and offset (little-endian), followed by the piece. Pieces
+ * are sent in order and without gap, a lost one drops the whole payload.
+ */
+
+
+#ifndef __MESSAGE_FRAGMENT__
+#define __MESSAGE_FRAGMENT__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "message.h"
+
+
+/** 
+ * @brief size of the header in front of each piece
+ */
+#define MESSAGE_FRAGMENT_HEADER_SIZE    4
+
+
+/** 
+ * @brief payload bytes carried by one fragment
+ */
+#define MESSAGE_FRAGMENT_SIZE   (MESSAGE_MAX_PAYLOAD_SIZE - 1 - MESSAGE_FRAGMENT_HEADER_SIZE)
+
+
+/** 
+ * @brief Struct contains one payload being put back together.
+ */ 
+typedef struct MessageReassembly {
+	uint8_t *buffer; /**< @brief destination of the payload */
+	uint16_t capacity; /**< @brief size of buffer in byte */
+	uint16_t total; /**< @brief length of the payload, 0 when idle */
+	uint16_t received; /**< @brief bytes stored so far */
+	uint8_t address; /**< @brief source of the payload */
+} MessageReassembly_t;
+
+
+/**
+ * @brief Initialize a reassembly context on user-provided storage.
+ * @param context context instance.
+ * @param buffer storage for the longest expected payload.
+ * @param capacity size of buffer in byte.
+ * @return nothing.
+ */
+void message_reassembly_init(MessageReassembly_t *context, 
+							void *buffer, 
+							uint16_t capacity);
+
+
+/**
+ * @brief Feed one received message to a reassembly context.
+ *
+ * Call it for each message taken out of the message box. A fragment from
+ * another source, an unexpected offset or a payload larger than the
+ * buffer drop the payload in progress.
+ *
+ * @param context context instance.
+ * @param message received message.
+ * @return length of the payload now complete in the buffer, 0 if the
+ * fragment was taken and more are expected, -1 if message is not a
+ * fragment and has to be handled as it is.
+ */
+int32_t message_reassemble(MessageReassembly_t *context, 
+							const Message_t *message);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_FRAGMENT__ */
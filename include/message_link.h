@@ -0,0 +1,186 @@
+/**
+ * @file message_link.h
+ * @brief Function prototypes for the hardware-independent part of a port
+ *
+ * Internal to the library. Each platform's MessagePort_t starts with a
+ * MessageLink_t, so a link pointer is also the handle of its port. The
+ * port file keeps the UART, its interrupts and its timers and reaches
+ * them through MessageLinkOps_t; the link builds and sends frames, hands
+ * received ones to the message box, peers or NAK handler, owns the
+ * deferred RX ring and implements the calls every platform shares.
+ */
+
+
+#ifndef __MESSAGE_LINK__
+#define __MESSAGE_LINK__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "message.h"
+#include "messagebox.h"
+#include "bytering.h"
+#include "message_parser.h"
+#include "message_cobs.h"
+#include "message_reliable.h"
+#include "crc32.h"
+
+
+/**
+ * @brief Struct contains message frame
+ */
+typedef struct MessageFrame {
+	uint8_t preamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief preamble of message frame */
+	uint8_t address[2]; /**< @brief destination and source address: 2 bytes*/
+	messagesize_t payloadSize; /**< @brief size of payload, 1 or 2 bytes */
+	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE]; /**< @brief payload */
+	crc32_t checksum; /**< @brief CRC-32 checksum: 4 bytes */
+	uint8_t delimiter; /**< @brief room for the COBS delimiter */
+} __attribute__((packed)) MessageFrame_t;
+
+
+/**
+ * @brief Struct contains the hooks of a port into its hardware
+ *
+ * Each one gets the port, which is also its link.
+ */
+typedef struct MessageLinkOps {
+	void (*write)(void *port, const void *data, uint32_t len); /**< @brief blocking write to the line */
+	void (*writeAddress)(void *port, uint8_t address); /**< @brief 9th-bit address character, NULL: a plain byte */
+	void (*waitIdle)(void *port); /**< @brief wait for a message_sendAsync() in progress */
+	void (*frameGap)(void *port); /**< @brief drain the line and keep it idle for MESSAGE_FRAME_GAP */
+	void (*lineFormat)(void *port); /**< @brief framing or address changed, may be NULL */
+} MessageLinkOps_t;
+
+
+/**
+ * @brief Struct contains the hardware-independent state of one port
+ */
+typedef struct MessageLink {
+	MessageParser_t parser; /**< @brief receive state */
+	MessageFrame_t txFrame; /**< @brief frame of message_sendAsync() */
+	MessageBox_t messageBox; /**< @brief received messages */
+	MessagePeer_t *peers; /**< @brief peers in reliable mode */
+	MessageNakCallback_t nakHandler; /**< @brief receiver of NAKs */
+	const MessageLinkOps_t *ops; /**< @brief hooks of the port */
+#if MESSAGE_DEFERRED
+	ByteRing_t rxRing; /**< @brief raw bytes from the receive side */
+	uint8_t rxRingData[MESSAGE_RX_RING_SIZE]; /**< @brief storage of rxRing */
+	uint8_t rxResyncs; /**< @brief resyncs queued by the receive side */
+	uint8_t rxResyncsDone; /**< @brief resyncs handed to the parser */
+	ringindex_t rxResyncAt[MESSAGE_RX_TIMEOUT_QUEUE]; /**< @brief rxRing position of each queued resync */
+#endif
+#if MESSAGE_STATS
+	MessageStats_t stats; /**< @brief counters kept by the port, not the parser */
+#endif
+} MessageLink_t;
+
+
+/**
+ * @brief Reset a link with the preamble, framing, address and NAK handler
+ * set by the message_set*() calls so far.
+ * @param link link instance, first member of its port.
+ * @param data an array of Message_t.
+ * @param num max size of FIFO buffer.
+ * @param ops hooks of the port.
+ * @return nothing.
+ */
+void message_link_init(MessageLink_t *link,
+						Message_t *data,
+						uint8_t num,
+						const MessageLinkOps_t *ops);
+
+
+/**
+ * @brief Make a link the default port of the calls without a port argument.
+ * @param link link instance.
+ * @return nothing.
+ */
+void message_link_setDefault(MessageLink_t *link);
+
+
+/**
+ * @brief Build a whole frame in txFrame.
+ *
+ * The checksum lies right behind the payload, a COBS frame is encoded in
+ * place over the unused preamble.
+ *
+ * @param link link instance.
+ * @param preamble preamble of the frame.
+ * @param des destination address.
+ * @param src source address.
+ * @param data payload.
+ * @param len payload size, cut to MESSAGE_MAX_PAYLOAD_SIZE.
+ * @return size of the frame from the start of txFrame, 0 if it does not
+ * fit there.
+ */
+uint16_t message_link_createFrame(MessageLink_t *link,
+						const void *preamble,
+						uint8_t des,
+						uint8_t src,
+						const void *data,
+						messagesize_t len);
+
+
+/**
+ * @brief Take received bytes, from the RX interrupt or receiver thread.
+ *
+ * With MESSAGE_DEFERRED they are queued for message_poll(), otherwise
+ * the frames they complete are delivered right away.
+ *
+ * @param link link instance.
+ * @param data received bytes.
+ * @param len number of bytes.
+ * @return nothing.
+ */
+void message_link_receive(MessageLink_t *link, const uint8_t *data, uint32_t len);
+
+
+/**
+ * @brief Drop the frame in progress, the line stayed idle for
+ * MESSAGE_RX_TIMEOUT or an address character starts the next one.
+ *
+ * Called on the receive side. With MESSAGE_DEFERRED the position in
+ * rxRing is queued and the parser drops the frame once message_poll()
+ * has fed it the bytes in front of it.
+ *
+ * @param link link instance.
+ * @return nothing.
+ */
+void message_link_resync(MessageLink_t *link);
+
+
+#if MESSAGE_STATS
+/**
+ * @brief Copy the counters of the link, its parser and message box.
+ *
+ * Not atomic, the port masks its receive side around it if needed.
+ *
+ * @param link link instance.
+ * @param stats copy of the counters.
+ * @return nothing.
+ */
+void message_link_getStats(MessageLink_t *link, MessageStats_t *stats);
+#endif
+
+
+#if MESSAGE_ISR_HISTOGRAM
+/**
+ * @brief Count one run of the receive path in the bin of its duration.
+ * @param link link instance.
+ * @param time cycles or ns, as the port measures it.
+ * @return nothing.
+ */
+void message_link_isrTime(MessageLink_t *link, uint32_t time);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_LINK__ */
@@ -0,0 +1,186 @@
+/** 
+ * @file message_parser.h
+ * @brief Function prototypes for the transport-independent frame parser
+ *
+ * The parser is fed whole buffers (one byte from an RX interrupt, a FIFO
+ * drain, a DMA block or a read() of a few KiB) and stops right behind each
+ * frame that passes the checksum. The payload is copied and checksummed a
+ * chunk at a time instead of through one call per byte.
+ */
+
+
+#ifndef __MESSAGE_PARSER__
+#define __MESSAGE_PARSER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "message.h"
+#include "crc32.h"
+
+
+/** 
+ * @brief bit of the frame length field announcing a flags byte
+ */
+#define MESSAGE_SIZE_FLAGS  ((messagesize_t)1 << (8 * sizeof(messagesize_t) - 1))
+
+
+/** 
+ * @brief Struct contains the receive state of one link.
+ */ 
+typedef struct MessageParser {
+	uint8_t step; /**< @brief field being parsed */
+	uint8_t framing; /**< @brief MessageFraming_t of the link */
+	uint8_t cobsCode; /**< @brief bytes left in the COBS block */
+	bool cobsZero; /**< @brief a zero follows the COBS block */
+	messagesize_t counter; /**< @brief bytes read in the current field */
+	messagesize_t size; /**< @brief length field as received */
+	bool ready; /**< @brief message holds a frame with a valid checksum */
+	volatile bool resync; /**< @brief drop the frame in progress before the next byte */
+	uint8_t validPreamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief expected preamble */
+	uint8_t nodeAddress; /**< @brief own address */
+	uint8_t addressMask; /**< @brief bits of the destination to compare */
+	uint8_t checksum[sizeof(crc32_t)]; /**< @brief received CRC-32 */
+	crc32_t preambleChecksum; /**< @brief checksum of validPreamble */
+	crc32_t runningChecksum; /**< @brief checksum of the frame so far */
+	Message_t message; /**< @brief addresses, size and payload */
+#if MESSAGE_STATS
+	uint32_t bytes; /**< @brief bytes fed */
+	uint32_t frames; /**< @brief frames with a valid checksum */
+	uint16_t crcErrors; /**< @brief frames with a bad checksum */
+	uint16_t truncated; /**< @brief frames cut to MESSAGE_MAX_PAYLOAD_SIZE */
+	uint16_t filtered; /**< @brief frames for other nodes */
+	uint16_t resyncs; /**< @brief preambles found after noise, dropped partial frames */
+	bool hunting; /**< @brief bytes were skipped since the last preamble */
+#endif
+} MessageParser_t;
+
+
+/**
+ * @brief Initialize a parser, waiting for a preamble.
+ * @param parser parser instance.
+ * @param preamble valid preamble, MESSAGE_PREAMBLE_SIZE bytes.
+ * @return nothing.
+ */
+void message_parser_init(MessageParser_t *parser, const void *preamble);
+
+
+/**
+ * @brief Change the valid preamble of a parser.
+ * @param parser parser instance.
+ * @param preamble valid preamble, MESSAGE_PREAMBLE_SIZE bytes.
+ * @return nothing.
+ */
+void message_parser_setPreamble(MessageParser_t *parser, const void *preamble);
+
+
+/**
+ * @brief Only take frames for one node, a group or a broadcast.
+ *
+ * A frame is taken if its destination is MESSAGE_BROADCAST or equals
+ * address in every bit set in mask. Other frames are skipped by their
+ * length field: their payload is neither copied nor checksummed.
+ *
+ * @param parser parser instance.
+ * @param address own address.
+ * @param mask 0xFF: address only, 0x00 (default): every frame.
+ * @return nothing.
+ */
+void message_parser_setAddress(MessageParser_t *parser, 
+								uint8_t address, 
+								uint8_t mask);
+
+
+/**
+ * @brief Change the wire format a parser expects.
+ *
+ * With kMessageFramingCOBS the parser takes the bytes up to the next 0x00
+ * as a frame and ignores the preamble. With kMessageFramingAddress every
+ * byte after a frame starts the next one.
+ *
+ * @param parser parser instance.
+ * @param framing wire format.
+ * @return nothing.
+ */
+void message_parser_setFraming(MessageParser_t *parser, MessageFraming_t framing);
+
+
+/**
+ * @brief Parse received bytes.
+ *
+ * Stops right behind the first frame with a valid checksum, so the caller
+ * can take it with message_parser_getMessage() and feed the rest again.
+ *
+ * @param parser parser instance.
+ * @param data received bytes.
+ * @param len the length of data in byte.
+ * @return the number of bytes consumed.
+ */
+uint32_t message_parser_feed(MessageParser_t *parser, 
+							const void *data, 
+							uint32_t len);
+
+
+/**
+ * @brief Drop the frame in progress after the line went idle.
+ *
+ * The next byte is taken as the possible start of a new frame; in COBS
+ * mode the idle line counts as a delimiter.
+ *
+ * @param parser parser instance.
+ * @return nothing.
+ */
+void message_parser_timeout(MessageParser_t *parser);
+
+
+/**
+ * @brief Drop the frame in progress once the next bytes are fed.
+ *
+ * Like message_parser_timeout(), but taken by the next
+ * message_parser_feed(), so it can be called from outside the context
+ * that feeds the parser.
+ *
+ * @param parser parser instance.
+ * @return nothing.
+ */
+void message_parser_resync(MessageParser_t *parser);
+
+
+/**
+ * @brief Check a destination against the address set for the parser.
+ *
+ * Lets a 9-bit receiver decide on the address character alone.
+ *
+ * @param parser parser instance.
+ * @param destination destination address of a frame.
+ * @return true if the frame is for this node.
+ */
+bool message_parser_accepts(const MessageParser_t *parser, uint8_t destination);
+
+
+/**
+ * @brief Check if the parser is between two frames.
+ * @param parser parser instance.
+ * @return true if no frame is in progress.
+ */
+bool message_parser_isIdle(const MessageParser_t *parser);
+
+
+/**
+ * @brief Get the message completed by the last message_parser_feed().
+ * @param parser parser instance.
+ * @return the message, NULL if the last call completed none. It stays
+ * valid until the next message_parser_feed().
+ */
+const Message_t* message_parser_getMessage(MessageParser_t *parser);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_PARSER__ */
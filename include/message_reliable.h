@@ -0,0 +1,177 @@
+/**
+ * @file message_reliable.h
+ * @brief Function prototypes for reliable delivery to a peer
+ *
+ * Selective repeat over the plain protocol. Each data frame is flagged
+ * MESSAGE_RELIABLE and starts with a sequence number; up to a window of
+ * them may wait for acknowledgement at the same time. The receiver
+ * answers with a frame flagged MESSAGE_ACK: the next sequence number it
+ * expects (cumulative), then a bitmap of the frames it already holds
+ * behind it (selective, little-endian). Frames are put into the message
+ * box in order; a full box holds the next one back, unacknowledged, so
+ * the sender retransmits it later. Unacknowledged frames are sent again
+ * once the timeout has passed. Both ends start at sequence number 0.
+ */
+
+
+#ifndef __MESSAGE_RELIABLE__
+#define __MESSAGE_RELIABLE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "message.h"
+#include "messagebox.h"
+
+
+/**
+ * @brief largest window, a power of two up to 32
+ */
+#ifndef MESSAGE_WINDOW_MAX
+#define MESSAGE_WINDOW_MAX  8
+#endif
+
+#if MESSAGE_WINDOW_MAX > 32 || (MESSAGE_WINDOW_MAX & (MESSAGE_WINDOW_MAX - 1))
+#error "MESSAGE_WINDOW_MAX must be a power of two up to 32"
+#endif
+
+
+/**
+ * @brief payload bytes one reliable frame can carry
+ */
+#define MESSAGE_RELIABLE_SIZE   (MESSAGE_MAX_PAYLOAD_SIZE - 2)
+
+
+/**
+ * @brief Struct contains the reliable link to one peer.
+ *
+ * The send side (message_sendReliable(), message_peer_poll()) runs in
+ * task context, the receive side in the receive path of the port. They
+ * only share the fields guarded by rxVersion and ackVersion.
+ */
+typedef struct MessagePeer {
+	MessagePortHandle_t port; /**< @brief link to the peer */
+	struct MessagePeer *next; /**< @brief next peer on the same port */
+	uint8_t preamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief preamble of the frames */
+	uint8_t source; /**< @brief own address */
+	uint8_t address; /**< @brief address of the peer */
+	uint8_t window; /**< @brief frames in flight at most */
+	uint32_t timeout; /**< @brief time before a frame is sent again */
+	Message_t *txSlots; /**< @brief frames waiting for their ACK */
+	Message_t *rxSlots; /**< @brief frames received ahead of order */
+	uint32_t sentAt[MESSAGE_WINDOW_MAX]; /**< @brief last send of each txSlot */
+	uint8_t txBase; /**< @brief oldest unacknowledged sequence number */
+	uint8_t txNext; /**< @brief next sequence number to send */
+	uint32_t txAcked; /**< @brief selective ACKs, bit i: txBase + i */
+	uint8_t rxVersion; /**< @brief odd while rxNext and rxHave change */
+	volatile uint8_t rxNext; /**< @brief next sequence number to deliver */
+	volatile uint32_t rxHave; /**< @brief frames held, bit i: rxNext + i */
+	bool ackDue; /**< @brief an ACK has to be sent */
+	uint8_t ackVersion; /**< @brief odd while ackNext and ackBits change */
+	uint8_t ackSeen; /**< @brief ackVersion already applied */
+	volatile uint8_t ackNext; /**< @brief cumulative part of the last ACK */
+	volatile uint32_t ackBits; /**< @brief selective part of the last ACK */
+} MessagePeer_t;
+
+
+/**
+ * @brief Initialize a peer on user-provided storage.
+ *
+ * Time is whatever unit the caller passes to message_sendReliable() and
+ * message_peer_poll(): milliseconds, timer ticks,...
+ *
+ * @param peer peer instance.
+ * @param preamble 4-byte frame preamble.
+ * @param source own address.
+ * @param address address of the peer.
+ * @param slots an array of 2 * window Message_t, the first half holds
+ * the frames to retransmit, the second one frames received out of order.
+ * @param window frames in flight at most, a power of two up to
+ * MESSAGE_WINDOW_MAX.
+ * @param timeout time before an unacknowledged frame is sent again.
+ * @return nothing.
+ */
+void message_peer_init(MessagePeer_t *peer,
+						const void *preamble,
+						uint8_t source,
+						uint8_t address,
+						Message_t *slots,
+						uint8_t window,
+						uint32_t timeout);
+
+
+/**
+ * @brief Attach a peer to a port.
+ *
+ * From now on reliable frames and ACKs from the peer address go to the
+ * peer, the messages it delivers to the message box of the port.
+ *
+ * @param port port instance.
+ * @param peer initialized peer.
+ * @return nothing.
+ */
+void messageport_addPeer(MessagePortHandle_t port, MessagePeer_t *peer);
+
+
+/**
+ * @brief Send a message reliably.
+ *
+ * The message is copied into a free slot and sent right away.
+ *
+ * @param peer peer instance.
+ * @param payload message need to be sent.
+ * @param len length of message, at most MESSAGE_RELIABLE_SIZE.
+ * @param now current time.
+ * @return 0: sent, -1: window is full or message too long.
+ */
+int message_sendReliable(MessagePeer_t *peer,
+						const void *payload,
+						uint16_t len,
+						uint32_t now);
+
+
+/**
+ * @brief Retransmit what timed out and send a due ACK.
+ *
+ * Call it periodically, e.g. from a timer tick or next to message_poll().
+ *
+ * @param peer peer instance.
+ * @param now current time.
+ * @return nothing.
+ */
+void message_peer_poll(MessagePeer_t *peer, uint32_t now);
+
+
+/**
+ * @brief Number of frames sent and not yet acknowledged.
+ * @param peer peer instance.
+ * @return frames in flight.
+ */
+uint8_t message_peer_inFlight(MessagePeer_t *peer);
+
+
+/**
+ * @brief Hand a received reliable frame or ACK to the peers of a port.
+ *
+ * Called by the receive path. Frames from an address without a peer are
+ * dropped.
+ *
+ * @param peers first peer of the port.
+ * @param message received message flagged MESSAGE_RELIABLE or MESSAGE_ACK.
+ * @param box message box of the port.
+ * @return nothing.
+ */
+void message_peer_receive(MessagePeer_t *peers,
+						const Message_t *message,
+						MessageBox_t *box);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MESSAGE_RELIABLE__ */
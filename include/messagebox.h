@@ -14,32 +14,158 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 typedef struct Message Message_t;
 
 
+/**
+ * @brief What messagebox_push() does with a message for a full box.
+ */
+typedef enum MessageOverflow {
+	kMessageOverflowDropNewest = 0, /**< @brief the new message is lost (default) */
+	kMessageOverflowOverwrite, /**< @brief the oldest message makes room, for latest values */
+	kMessageOverflowReject /**< @brief the new message is lost, its sender gets a NAK */
+} MessageOverflow_t;
+
+
+/**
+ * @brief Struct contains the overflow counters of a box.
+ */
+typedef struct MessageBoxCounters {
+	uint16_t dropped; /**< @brief new messages lost */
+	uint16_t overwritten; /**< @brief old messages replaced */
+	uint16_t rejected; /**< @brief new messages refused with a NAK */
+} __attribute__((packed)) MessageBoxCounters_t;
+
+
+/**
+ * @brief Picks the priority class of a message, 0 is the lowest.
+ *
+ * Called by messagebox_push(), so in the receive path (RX interrupt or
+ * thread).
+ */
+typedef uint8_t (*MessageClassify_t)(const Message_t *message);
+
+
 /** 
  * @brief Struct contains FIFO buffer containing received messages.
+ *
+ * Lock-free for one producer (RX interrupt or thread) and one consumer:
+ * writePoint is only stored by messagebox_push(), readPoint only by
+ * messagebox_pop()/messagebox_release(). Both count over [0, 2*capacity)
+ * so a full box needs no extra flag, and a power-of-two capacity lets
+ * them run freely and wrap with a mask.
+ *
+ * A box can have more lanes, one per priority class, each a box of its
+ * own; see messagebox_setLanes().
+ *
+ * With kMessageOverflowOverwrite the producer takes the oldest message
+ * from the consumer by compare-and-swap on readPoint (with interrupts off
+ * on AVR), and messagebox_pop() copies again if its message was replaced
+ * meanwhile.
  */ 
 typedef struct MessageBox {
 	Message_t *data; /**< @brief Array of pointers to messages */
 	uint8_t readPoint; /**< @brief Reading point */
 	uint8_t writePoint; /**< @brief Writting point */
 	uint8_t capacity; /**< @brief The capacity of FIFO buffer */
-	bool isFull; /**< @brief State of buffer, full or not */
+	uint8_t mask; /**< @brief capacity - 1 for a power of two, else 0 */
+	struct MessageBox *lanes; /**< @brief lanes of class 1..laneCount */
+	MessageClassify_t classify; /**< @brief class of a message, NULL: flags */
+	uint8_t laneCount; /**< @brief number of lanes above this box */
+	uint8_t peekLane; /**< @brief lane of the last messagebox_peek() */
+	uint8_t peekPoint; /**< @brief readPoint of the last messagebox_peek() */
+	uint8_t overflow; /**< @brief MessageOverflow_t of the box */
+	MessageBoxCounters_t counters; /**< @brief overflows so far */
+	bool nakDue; /**< @brief a rejected sender waits for its NAK */
+	uint8_t nakAddress; /**< @brief source of the last rejected message */
 } __attribute__((packed)) MessageBox_t;
 
 
 /**
  * @brief Create new ring buffer.
  * @param data pointer to array containing data
- * @param num max number of element in buffer.
+ * @param num max number of element in buffer, at most 128. A power of two
+ * avoids the compare on each wrap.
  * @return new MessageBox_t instance.
  */
 MessageBox_t messagebox_create(Message_t *data, uint8_t num);
 
 
+/**
+ * @brief Add priority lanes to a ring buffer.
+ *
+ * The buffer itself becomes lane 0, the lowest class, and lanes[i] takes
+ * class i + 1; higher classes go to the top lane. messagebox_pop() and
+ * messagebox_peek() always serve the highest non-empty lane, so urgent
+ * messages overtake a backlog of bulk ones. Call it before messages
+ * arrive.
+ *
+ * Capacity, used and free space and messagebox_isFull() still refer to
+ * one lane, messagebox_isEmpty() to all of them.
+ *
+ * @param buffer ring buffer instance.
+ * @param lanes array of buffers from messagebox_create(), each with its
+ * own storage and capacity.
+ * @param n number of lanes in the array.
+ * @param classify class of a message, NULL takes it from the
+ * MESSAGE_PRIORITY bits of Message_t::flags.
+ * @return nothing.
+ */
+void messagebox_setLanes(MessageBox_t* buffer, 
+						MessageBox_t *lanes, 
+						uint8_t n, 
+						MessageClassify_t classify);
+
+
+/**
+ * @brief Get the lane a message would be pushed to.
+ * @param buffer ring buffer instance.
+ * @param message message instance.
+ * @return buffer itself without lanes.
+ */
+MessageBox_t* messagebox_getLane(MessageBox_t* buffer, const Message_t *message);
+
+
+/**
+ * @brief Choose what happens to messages for a full ring buffer.
+ *
+ * Applies to this box only, lanes have their own policy. Rejected
+ * senders are answered with a MESSAGE_NAK frame from message_poll().
+ * With kMessageOverflowOverwrite, a message from messagebox_peek() may be
+ * replaced before it is released; take messages with messagebox_pop().
+ *
+ * @param buffer ring buffer instance.
+ * @param policy kMessageOverflowDropNewest (default),
+ * kMessageOverflowOverwrite or kMessageOverflowReject.
+ * @return nothing.
+ */
+void messagebox_setOverflow(MessageBox_t* buffer, MessageOverflow_t policy);
+
+
+/**
+ * @brief Get the overflow counters.
+ * @param buffer ring buffer instance.
+ * @param counters sum over the buffer and its lanes.
+ * @return nothing.
+ */
+void messagebox_getCounters(MessageBox_t* buffer, MessageBoxCounters_t *counters);
+
+
+/**
+ * @brief Take the source of the last rejected message, once.
+ *
+ * Used by message_poll() to send the NAK, checks the lanes as well.
+ *
+ * @param buffer ring buffer instance.
+ * @param address source address of the rejected message.
+ * @return true if a NAK is due.
+ */
+bool messagebox_takeNak(MessageBox_t* buffer, uint8_t *address);
+
+
 /**
  * @brief Destroy a ring buffer.
  *
@@ -59,7 +185,7 @@ void messagebox_clear(MessageBox_t* buffer);
 
 
 /**
- * @brief Check if ring buffer is empty
+ * @brief Check if ring buffer is empty, all lanes included
  * @param buffer ring buffer instance.
  * @return state of ring buffer.
  */
@@ -107,12 +233,15 @@ uint8_t messagebox_getFreeSpace(MessageBox_t* buffer);
 
 
 /**
- * @brief Push new message to ring buffer
+ * @brief Push new message to ring buffer, or to the lane of its class
+ *
+ * A full lane handles the message by its overflow policy.
+ *
  * @param buffer ring buffer instance.
  * @param message message instance.
- * @return the number of free space of buffer
+ * @return 0: stored, -1: dropped or rejected.
  */
-void messagebox_push(MessageBox_t* buffer, Message_t *message);
+int messagebox_push(MessageBox_t* buffer, const Message_t *message);
 
 
 /**
@@ -124,6 +253,26 @@ void messagebox_push(MessageBox_t* buffer, Message_t *message);
 int messagebox_pop(MessageBox_t* buffer, Message_t *message);
 
 
+/**
+ * @brief Look at the oldest message without copying it
+ *
+ * The message stays in the buffer and its slot is not reused until
+ * messagebox_release() is called.
+ *
+ * @param buffer ring buffer instance.
+ * @return pointer into the data array, NULL if buffer is empty.
+ */
+const Message_t* messagebox_peek(MessageBox_t* buffer);
+
+
+/**
+ * @brief Free the slot of the message returned by messagebox_peek()
+ * @param buffer ring buffer instance.
+ * @return nothing.
+ */
+void messagebox_release(MessageBox_t* buffer);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,45 @@
+/**
+ * @file preamble_scan.h
+ * @brief Vectorized preamble search for host builds.
+ *
+ * x86-64 compares 16 (SSE2) or 32 (AVX2, picked at runtime) positions per
+ * step, AArch64 compares 16 with NEON. Other hosts fall back to memchr().
+ * Used by the frame parser to resynchronise on captured or noisy streams.
+ */
+
+
+#ifndef __PREAMBLE_SCAN__
+#define __PREAMBLE_SCAN__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+/**
+ * @brief find the starts of a 4-byte preamble in a byte array.
+ *
+ * Only complete preambles are reported, a preamble cut by the end of the
+ * array is not.
+ *
+ * @param data pointer to data.
+ * @param len the length of data in byte.
+ * @param preamble the 4 bytes to look for.
+ * @param starts array receiving the offsets, in increasing order.
+ * @param max size of starts, the search stops when it is full.
+ * @return the number of offsets stored.
+ */
+uint32_t preamble_scan(const void *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PREAMBLE_SCAN__ */
@@ -13,6 +13,8 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include <stdint.h>
 
 /**
  * @brief Initialize UART bus with baudrate
@@ -29,6 +31,52 @@ void tiva_uart_init(uint32_t base, uint32_t baudrate);
 void atmega_uart_init(uint32_t baudrate);
 
 
+/**
+ * @brief Attach UART functions to a POSIX file descriptor
+ *
+ * fd may be a tty, one side of a pty pair or a socketpair. It is switched
+ * to non-blocking mode; a tty is also put in raw 8N1 mode.
+ *
+ * @param fd opened file descriptor.
+ * @param baudrate UART baudrate, only applied to a tty; 0 keeps its speed.
+ * @return baudrate the tty runs at, 0 if unknown; baudrate for other fds.
+ */
+uint32_t host_uart_init(int fd, uint32_t baudrate);
+
+
+/**
+ * @brief Prepare a POSIX file descriptor like host_uart_init() does
+ *
+ * The UART functions stay attached to their current fd; use it for extra
+ * links driven through host_uart_sendBuffer() and read().
+ *
+ * @param fd opened file descriptor.
+ * @param baudrate UART baudrate, only applied to a tty; 0 keeps its speed.
+ * @return baudrate the tty runs at, 0 if unknown; baudrate for other fds.
+ */
+uint32_t host_uart_open(int fd, uint32_t baudrate);
+
+
+/**
+ * @brief transmit a byte array via the given file descriptor (host only)
+ * @param fd file descriptor prepared by host_uart_open().
+ * @param data pointer to data.
+ * @param len the length of data in byte.
+ * @return nothing.
+ */
+void host_uart_sendBuffer(int fd, const void* data, uint32_t len);
+
+
+/**
+ * @brief check if received bytes are waiting (host only)
+ *
+ * Never blocks, uart_receive() can be called without waiting if true.
+ *
+ * @return true if at least one byte is available.
+ */
+bool host_uart_charsAvail(void);
+
+
 /**
  * @brief transmit one byte via UART bus
  * @param data one byte data.
@@ -98,6 +98,15 @@ crc32_t crc32_concat(crc32_t checksum, const void* data, uint32_t len) {
 }
 
 
+crc32_t crc32_concatByte(crc32_t checksum, uint8_t data) {
+	checksum = ~checksum;
+	checksum = pgm_read_dword(crc32Table + (data ^ (checksum & 0xFF))) 
+				^ (checksum >> 8);
+
+	return ~checksum;
+}
+
+
 int crc32_selfcheck(const void *data, uint32_t len, crc32_t crc) {
 	uint8_t msg[len + 4];
 	crc = ~crc;
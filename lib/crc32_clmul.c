@@ -0,0 +1,263 @@
+/**
+ * @file crc32_clmul.c
+ * @brief Carry-less multiply folding for CRC-32 on host CPUs.
+ *
+ * Four 128-bit lanes are folded 64 bytes at a time, reduced to one lane,
+ * then to 64 bits and finally to 32 bits by Barrett reduction, following
+ * Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+ * The constants are x^n mod P for the reflected polynomial 0xEDB88320.
+ */
+
+#include "crc32_clmul.h"
+
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+/* x^(4*128+32) mod P, x^(4*128-32) mod P: fold by 64 bytes */
+static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+/* x^(128+32) mod P, x^(128-32) mod P: fold by 16 bytes */
+static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+/* x^64 mod P: fold 96 bits to 64 bits */
+static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+/* P and floor(x^64 / P) for Barrett reduction */
+static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+#endif
+
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+
+bool crc32_clmul_available(void) {
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+
+__attribute__((target("pclmul,sse4.1")))
+crc32_t crc32_clmul(crc32_t remainder, const uint8_t *msg, uint32_t len) {
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((__m128i*)(msg + 0x00));
+	x2 = _mm_loadu_si128((__m128i*)(msg + 0x10));
+	x3 = _mm_loadu_si128((__m128i*)(msg + 0x20));
+	x4 = _mm_loadu_si128((__m128i*)(msg + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(remainder));
+	x0 = _mm_load_si128((__m128i*)k1k2);
+
+	msg += 64;
+	len -= 64;
+
+	// fold 64 bytes per iteration
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((__m128i*)(msg + 0x00));
+		y6 = _mm_loadu_si128((__m128i*)(msg + 0x10));
+		y7 = _mm_loadu_si128((__m128i*)(msg + 0x20));
+		y8 = _mm_loadu_si128((__m128i*)(msg + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		msg += 64;
+		len -= 64;
+	}
+
+	// fold 4 lanes into 1
+	x0 = _mm_load_si128((__m128i*)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// fold remaining 16-byte blocks
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((__m128i*)msg);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		msg += 16;
+		len -= 16;
+	}
+
+	// 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((__m128i*)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((__m128i*)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (crc32_t)_mm_extract_epi32(x1, 1);
+}
+
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+
+bool crc32_clmul_available(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
+
+
+/* same lane selection as _mm_clmulepi64_si128(a, b, imm) */
+__attribute__((target("+crypto")))
+static inline uint64x2_t clmul(uint64x2_t a, int la, uint64x2_t b, int lb) {
+	poly64_t pa = (poly64_t)(la ? vgetq_lane_u64(a, 1) : vgetq_lane_u64(a, 0));
+	poly64_t pb = (poly64_t)(lb ? vgetq_lane_u64(b, 1) : vgetq_lane_u64(b, 0));
+
+	return vreinterpretq_u64_p128(vmull_p64(pa, pb));
+}
+
+
+__attribute__((target("+crypto")))
+crc32_t crc32_clmul(crc32_t remainder, const uint8_t *msg, uint32_t len) {
+	const uint64x2_t zero = vdupq_n_u64(0);
+	uint64x2_t x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x00));
+	x2 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x10));
+	x3 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x20));
+	x4 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x30));
+
+	x1 = veorq_u64(x1, vreinterpretq_u64_u32(vsetq_lane_u32(remainder,
+											vdupq_n_u32(0), 0)));
+	x0 = vld1q_u64(k1k2);
+
+	msg += 64;
+	len -= 64;
+
+	// fold 64 bytes per iteration
+	while (len >= 64) {
+		x5 = clmul(x1, 0, x0, 0);
+		x6 = clmul(x2, 0, x0, 0);
+		x7 = clmul(x3, 0, x0, 0);
+		x8 = clmul(x4, 0, x0, 0);
+
+		x1 = clmul(x1, 1, x0, 1);
+		x2 = clmul(x2, 1, x0, 1);
+		x3 = clmul(x3, 1, x0, 1);
+		x4 = clmul(x4, 1, x0, 1);
+
+		y5 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x00));
+		y6 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x10));
+		y7 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x20));
+		y8 = vreinterpretq_u64_u8(vld1q_u8(msg + 0x30));
+
+		x1 = veorq_u64(veorq_u64(x1, x5), y5);
+		x2 = veorq_u64(veorq_u64(x2, x6), y6);
+		x3 = veorq_u64(veorq_u64(x3, x7), y7);
+		x4 = veorq_u64(veorq_u64(x4, x8), y8);
+
+		msg += 64;
+		len -= 64;
+	}
+
+	// fold 4 lanes into 1
+	x0 = vld1q_u64(k3k4);
+
+	x5 = clmul(x1, 0, x0, 0);
+	x1 = clmul(x1, 1, x0, 1);
+	x1 = veorq_u64(veorq_u64(x1, x2), x5);
+
+	x5 = clmul(x1, 0, x0, 0);
+	x1 = clmul(x1, 1, x0, 1);
+	x1 = veorq_u64(veorq_u64(x1, x3), x5);
+
+	x5 = clmul(x1, 0, x0, 0);
+	x1 = clmul(x1, 1, x0, 1);
+	x1 = veorq_u64(veorq_u64(x1, x4), x5);
+
+	// fold remaining 16-byte blocks
+	while (len >= 16) {
+		x2 = vreinterpretq_u64_u8(vld1q_u8(msg));
+
+		x5 = clmul(x1, 0, x0, 0);
+		x1 = clmul(x1, 1, x0, 1);
+		x1 = veorq_u64(veorq_u64(x1, x2), x5);
+
+		msg += 16;
+		len -= 16;
+	}
+
+	// 128 bits to 64 bits
+	x2 = clmul(x1, 0, x0, 1);
+	x3 = vreinterpretq_u64_u32((uint32x4_t){ ~0u, 0, ~0u, 0 });
+	x1 = vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x1),
+										vreinterpretq_u8_u64(zero), 8));
+	x1 = veorq_u64(x1, x2);
+
+	x0 = vld1q_u64(k5k0);
+
+	x2 = vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x1),
+										vreinterpretq_u8_u64(zero), 4));
+	x1 = vandq_u64(x1, x3);
+	x1 = clmul(x1, 0, x0, 0);
+	x1 = veorq_u64(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = vld1q_u64(poly);
+
+	x2 = vandq_u64(x1, x3);
+	x2 = clmul(x2, 0, x0, 1);
+	x2 = vandq_u64(x2, x3);
+	x2 = clmul(x2, 0, x0, 0);
+	x1 = veorq_u64(x1, x2);
+
+	return vgetq_lane_u32(vreinterpretq_u32_u64(x1), 1);
+}
+
+
+#else
+
+bool crc32_clmul_available(void) {
+	return false;
+}
+
+
+crc32_t crc32_clmul(crc32_t remainder, const uint8_t *msg, uint32_t len) {
+	return remainder;
+}
+
+#endif
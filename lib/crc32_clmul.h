@@ -0,0 +1,43 @@
+/**
+ * @file crc32_clmul.h
+ * @brief Carry-less multiply folding for CRC-32 on host CPUs.
+ *
+ * x86-64 uses PCLMULQDQ, AArch64 uses PMULL. Both are only called when
+ * crc32_clmul_available() says the running CPU has them.
+ */
+
+
+#ifndef __CRC32_CLMUL__
+#define __CRC32_CLMUL__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "crc32.h"
+
+
+/**
+ * @brief shortest input worth folding, shorter input goes to the tables.
+ */
+#define CRC32_CLMUL_MIN_SIZE	64
+
+
+/**
+ * @brief check if the running CPU supports carry-less multiplication.
+ * @return true if crc32_clmul() can be called.
+ */
+bool crc32_clmul_available(void);
+
+
+/**
+ * @brief fold a byte array into a CRC-32 remainder (not inverted).
+ *
+ * Only whole 16-byte blocks are consumed, the caller finishes the tail.
+ *
+ * @param remainder current remainder.
+ * @param msg pointer to data.
+ * @param len the length of data in byte, at least CRC32_CLMUL_MIN_SIZE.
+ * @return new remainder after (len & ~15) bytes.
+ */
+crc32_t crc32_clmul(crc32_t remainder, const uint8_t *msg, uint32_t len);
+
+#endif /* __CRC32_CLMUL__ */
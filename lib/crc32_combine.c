@@ -0,0 +1,66 @@
+/** 
+ * @file crc32_combine.c
+ * @brief Function implementation for combining CRC-32 checksums.
+ *
+ * Polynomials are in reflected form: bit 31 is x^0, bit 0 is x^31.
+ * Appending n bytes to a message multiplies its CRC by x^(8n) mod P, which
+ * is computed by repeated squaring instead of feeding n zero bytes.
+ */
+
+#include "crc32.h"
+
+#define CRC32POLY_REVERSE	0xEDB88320
+
+
+/**
+ * @brief multiply a and b modulo P, a must not be 0.
+ */
+static crc32_t multmodp(crc32_t a, crc32_t b) {
+	crc32_t m = (crc32_t)1 << 31;
+	crc32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32POLY_REVERSE : b >> 1;
+	}
+
+	return p;
+}
+
+
+crc32_t crc32_combine_gen(uint32_t len) {
+	crc32_t p = (crc32_t)1 << 31;	// x^0
+	crc32_t square = (crc32_t)1 << 23;	// x^8, one byte
+
+	while (len) {
+		if (len & 1) {
+			p = multmodp(square, p);
+		}
+
+		len >>= 1;
+
+		if (len) {
+			square = multmodp(square, square);
+		}
+	}
+
+	return p;
+}
+
+
+crc32_t crc32_combine_op(crc32_t crcA, crc32_t crcB, crc32_t op) {
+	return multmodp(op, crcA) ^ crcB;
+}
+
+
+crc32_t crc32_combine(crc32_t crcA, crc32_t crcB, uint32_t lenB) {
+	return crc32_combine_op(crcA, crcB, crc32_combine_gen(lenB));
+}
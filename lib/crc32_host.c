@@ -0,0 +1,94 @@
+/** 
+ * @file crc32_host.c
+ * @brief Function implementation for computing CRC-32 checksum for POSIX hosts.
+ */
+
+#include <string.h>
+#include "crc32.h"
+#include "crc32_table.h"
+
+#if CRC32_CLMUL
+#include "crc32_clmul.h"
+#endif
+
+#define CRC32POLY			0x04C11DB7
+#define CRC32POLY_REVERSE	0xEDB88320
+
+
+uint8_t reverse(uint8_t number) {
+	uint8_t result = 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		result = (result << 1) + ((number >> i) & 1);
+	}
+	return result;
+}
+
+
+#if CRC32_CLMUL
+static bool useClmul;
+
+
+/**
+ * @brief pick carry-less multiply folding once, before main() runs.
+ */
+__attribute__((constructor))
+static void crc32_dispatch(void) {
+	useClmul = crc32_clmul_available();
+}
+#endif
+
+
+static crc32_t crc32_update(crc32_t remainder, const uint8_t *msg, uint32_t len) {
+#if CRC32_CLMUL
+	if (useClmul && len >= CRC32_CLMUL_MIN_SIZE) {
+		uint32_t folded = len & ~15u;
+
+		remainder = crc32_clmul(remainder, msg, len);
+		msg += folded;
+		len -= folded;
+	}
+#endif
+
+	return crc32_slice(remainder, msg, len);
+}
+
+
+crc32_t crc32_compute(const void *data, uint32_t len) {
+	return ~crc32_update(0xFFFFFFFF, data, len);
+}
+
+
+crc32_t crc32_concat(crc32_t checksum, const void* data, uint32_t len) {
+	return ~crc32_update(~checksum, data, len);
+}
+
+
+crc32_t crc32_concatByte(crc32_t checksum, uint8_t data) {
+	checksum = ~checksum;
+	checksum = crc32Table[0][data ^ (checksum & 0xFF)] ^ (checksum >> 8);
+
+	return ~checksum;
+}
+
+
+int crc32_selfcheck(const void *data, uint32_t len, crc32_t crc) {
+	uint8_t msg[len + 4];
+	crc = ~crc;
+
+	memcpy(msg, data, len);
+	memcpy(msg+len, &crc, 4);
+
+	int ret = crc32_check(msg, len+4);
+
+	return ret;
+}
+
+
+int crc32_check(const void *data, uint32_t len) {
+	crc32_t ret = ~crc32_compute(data, len);
+
+	if (ret == 0)
+		return 0;
+
+	return -1;
+}
\ No newline at end of file
@@ -0,0 +1,211 @@
+/**
+ * @file preamble_scan_host.c
+ * @brief Vectorized preamble search for host builds.
+ *
+ * Each step loads the block at offsets 0, 1, 2 and 3, compares every load
+ * with one preamble byte and ANDs the results, so a set lane marks a full
+ * 4-byte match. The bytes left behind the last block go through memchr().
+ */
+
+#include <string.h>
+#include "preamble_scan.h"
+
+
+typedef uint32_t (*scanfunc)(const uint8_t*, uint32_t, const uint8_t*, 
+							uint32_t*, uint32_t);
+
+
+static uint32_t scanTail(const uint8_t *data, 
+						uint32_t i, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t count, 
+						uint32_t max) 
+{
+	while (count < max && i + 4 <= len) {
+		const uint8_t *hit = memchr(data + i, preamble[0], len - 3 - i);
+
+		if (hit == NULL) {
+			break;
+		}
+
+		i = hit - data;
+
+		if (memcmp(hit, preamble, 4) == 0) {
+			starts[count++] = i;
+		}
+
+		i++;
+	}
+
+	return count;
+}
+
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+
+static uint32_t scanSSE2(const uint8_t *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max) 
+{
+	const __m128i p0 = _mm_set1_epi8((char)preamble[0]);
+	const __m128i p1 = _mm_set1_epi8((char)preamble[1]);
+	const __m128i p2 = _mm_set1_epi8((char)preamble[2]);
+	const __m128i p3 = _mm_set1_epi8((char)preamble[3]);
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	// the load at offset 3 reads 3 bytes past the block
+	for (; count < max && i + 16 + 3 <= len; i += 16) {
+		__m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(data + i)), p0);
+		__m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(data + i + 1)), p1);
+		__m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(data + i + 2)), p2);
+		__m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(data + i + 3)), p3);
+
+		uint32_t bits = (uint32_t)_mm_movemask_epi8(
+							_mm_and_si128(_mm_and_si128(m0, m1), 
+										_mm_and_si128(m2, m3)));
+
+		while (bits && count < max) {
+			starts[count++] = i + __builtin_ctz(bits);
+			bits &= bits - 1;
+		}
+	}
+
+	if (count == max) {
+		return count;
+	}
+
+	return scanTail(data, i, len, preamble, starts, count, max);
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t scanAVX2(const uint8_t *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max) 
+{
+	const __m256i p0 = _mm256_set1_epi8((char)preamble[0]);
+	const __m256i p1 = _mm256_set1_epi8((char)preamble[1]);
+	const __m256i p2 = _mm256_set1_epi8((char)preamble[2]);
+	const __m256i p3 = _mm256_set1_epi8((char)preamble[3]);
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	for (; count < max && i + 32 + 3 <= len; i += 32) {
+		__m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(data + i)), p0);
+		__m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(data + i + 1)), p1);
+		__m256i m2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(data + i + 2)), p2);
+		__m256i m3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(data + i + 3)), p3);
+
+		uint32_t bits = (uint32_t)_mm256_movemask_epi8(
+							_mm256_and_si256(_mm256_and_si256(m0, m1), 
+											_mm256_and_si256(m2, m3)));
+
+		while (bits && count < max) {
+			starts[count++] = i + __builtin_ctz(bits);
+			bits &= bits - 1;
+		}
+	}
+
+	if (count == max) {
+		return count;
+	}
+
+	// at most 34 bytes left
+	return scanTail(data, i, len, preamble, starts, count, max);
+}
+
+
+static scanfunc scan = scanSSE2;
+
+
+/**
+ * @brief pick AVX2 once, before main() runs.
+ */
+__attribute__((constructor))
+static void preamble_scan_dispatch(void) {
+	if (__builtin_cpu_supports("avx2")) {
+		scan = scanAVX2;
+	}
+}
+
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+
+static uint32_t scanNEON(const uint8_t *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max) 
+{
+	const uint8x16_t p0 = vdupq_n_u8(preamble[0]);
+	const uint8x16_t p1 = vdupq_n_u8(preamble[1]);
+	const uint8x16_t p2 = vdupq_n_u8(preamble[2]);
+	const uint8x16_t p3 = vdupq_n_u8(preamble[3]);
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	for (; count < max && i + 16 + 3 <= len; i += 16) {
+		uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(data + i), p0),
+										vceqq_u8(vld1q_u8(data + i + 1), p1)),
+								vandq_u8(vceqq_u8(vld1q_u8(data + i + 2), p2),
+										vceqq_u8(vld1q_u8(data + i + 3), p3)));
+
+		// NEON has no movemask: narrow each lane to 4 bits
+		uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(
+							vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+		while (bits && count < max) {
+			starts[count++] = i + (__builtin_ctzll(bits) >> 2);
+			bits &= ~(0xFULL << (__builtin_ctzll(bits) & ~3));
+		}
+	}
+
+	if (count == max) {
+		return count;
+	}
+
+	return scanTail(data, i, len, preamble, starts, count, max);
+}
+
+
+static const scanfunc scan = scanNEON;
+
+
+#else
+
+static uint32_t scanScalar(const uint8_t *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max) 
+{
+	return scanTail(data, 0, len, preamble, starts, 0, max);
+}
+
+
+static const scanfunc scan = scanScalar;
+
+#endif
+
+
+uint32_t preamble_scan(const void *data, 
+						uint32_t len, 
+						const uint8_t *preamble,
+						uint32_t *starts, 
+						uint32_t max) 
+{
+	return scan((const uint8_t*)data, len, preamble, starts, max);
+}
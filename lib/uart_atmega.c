@@ -45,7 +45,7 @@ void uart_send(uint8_t data) {
 void uart_sendBuffer(const void* buffer, uint32_t len) {
 	const uint8_t *data = (uint8_t*)buffer;
 
-	for (uint8_t i = 0; i < len; i++) {
+	for (uint32_t i = 0; i < len; i++) {
 		uart_send(data[i]);
 	}
 }
@@ -0,0 +1,215 @@
+/**
+ * @file uart_host.c
+ * @brief Functions for UART communication protocol on POSIX hosts.
+ *
+ * The "UART" is any file descriptor: a tty, a pty pair or a socketpair.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "uart.h"
+
+
+#define RX_BUFFER_SIZE	4096
+
+
+static int UARTfd = -1;
+static uint8_t rxBuffer[RX_BUFFER_SIZE];
+static uint32_t rxRead;
+static uint32_t rxEnd;
+
+
+static const struct {
+	uint32_t baudrate;
+	speed_t speed;
+} speeds[] = {
+	{ 1200, B1200 },
+	{ 2400, B2400 },
+	{ 4800, B4800 },
+	{ 9600, B9600 },
+	{ 19200, B19200 },
+	{ 38400, B38400 },
+	{ 57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+	{ 460800, B460800 },
+	{ 921600, B921600 },
+};
+
+
+static speed_t getSpeed(uint32_t baudrate) {
+	for (uint32_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].baudrate == baudrate) {
+			return speeds[i].speed;
+		}
+	}
+
+	return B0;
+}
+
+
+static uint32_t getBaudrate(speed_t speed) {
+	for (uint32_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].speed == speed) {
+			return speeds[i].baudrate;
+		}
+	}
+
+	return 0;
+}
+
+
+static short waitFor(int fd, short events) {
+	struct pollfd pfd = { .fd = fd, .events = events };
+
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+		// retry
+	}
+
+	return pfd.revents;
+}
+
+
+uint32_t host_uart_init(int fd, uint32_t baudrate) {
+	UARTfd = fd;
+	rxRead = 0;
+	rxEnd = 0;
+
+	return host_uart_open(fd, baudrate);
+}
+
+
+uint32_t host_uart_open(int fd, uint32_t baudrate) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (isatty(fd)) {
+		struct termios tty;
+
+		if (tcgetattr(fd, &tty) == 0) {
+			cfmakeraw(&tty);
+			tty.c_cflag |= CLOCAL | CREAD;
+			tty.c_cflag &= ~(CSTOPB | PARENB);
+
+			// 0 or an unknown rate keeps the speed the tty already has
+			speed_t speed = getSpeed(baudrate);
+			if (speed != B0) {
+				cfsetispeed(&tty, speed);
+				cfsetospeed(&tty, speed);
+			}
+
+			tcsetattr(fd, TCSANOW, &tty);
+
+			return getBaudrate(cfgetospeed(&tty));
+		}
+	}
+
+	return baudrate;
+}
+
+
+bool host_uart_charsAvail(void) {
+	if (rxRead < rxEnd) {
+		return true;
+	}
+
+	ssize_t n = read(UARTfd, rxBuffer, sizeof(rxBuffer));
+
+	if (n > 0) {
+		rxRead = 0;
+		rxEnd = (uint32_t)n;
+		return true;
+	}
+
+	return false;
+}
+
+
+void uart_send(uint8_t data) {
+	uart_sendBuffer(&data, 1);
+}
+
+
+void uart_sendBuffer(const void* buffer, uint32_t len) {
+	host_uart_sendBuffer(UARTfd, buffer, len);
+}
+
+
+void host_uart_sendBuffer(int fd, const void* buffer, uint32_t len) {
+	const uint8_t *data = (uint8_t*)buffer;
+
+	while (len) {
+		ssize_t n = write(fd, data, len);
+
+		if (n > 0) {
+			data += n;
+			len -= (uint32_t)n;
+		}
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			waitFor(fd, POLLOUT);
+		}
+		else if (!(n < 0 && errno == EINTR)) {
+			// peer is gone, nothing can be sent anymore
+			return;
+		}
+	}
+}
+
+
+void uart_putchar(char c) {
+	if (c == '\n') {
+		uart_send('\r');
+	}
+
+	uart_send(c);
+
+	if (c == '\r') {
+		uart_send('\n');
+	}
+}
+
+
+void uart_print(const char* string) {
+	for (uint32_t i = 0; i < strlen(string); i++) {
+		uart_putchar(string[i]);
+	}
+}
+
+
+uint8_t uart_receive(void) {
+	while (!host_uart_charsAvail()) {
+		if (waitFor(UARTfd, POLLIN) & (POLLHUP | POLLERR | POLLNVAL)) {
+			if (!host_uart_charsAvail()) {
+				// peer is gone, nothing will arrive anymore
+				return 0;
+			}
+		}
+	}
+
+	return rxBuffer[rxRead++];
+}
+
+
+char uart_getchar(void) {
+	return uart_receive();
+}
+
+
+void uart_flush(void) {
+	rxRead = rxEnd;
+
+	if (isatty(UARTfd)) {
+		tcflush(UARTfd, TCIFLUSH);
+	}
+	else {
+		while (read(UARTfd, rxBuffer, sizeof(rxBuffer)) > 0) {
+			// discard
+		}
+	}
+}
@@ -0,0 +1,63 @@
+/**
+ * @file bytering.c
+ * @brief Implementation for a lock-free single-producer/single-consumer
+ * byte ring.
+ *
+ * The data byte is stored before head is published (release), and the
+ * other side loads the index with acquire, so it works across cores on
+ * host builds as well as between an ISR and the main loop.
+ */
+
+#include <assert.h>
+#include "bytering.h"
+
+
+void bytering_init(ByteRing_t *ring, uint8_t *data, ringindex_t size) {
+	assert(ring && data);
+	assert(size && (size & (size - 1)) == 0);
+	assert(size <= (ringindex_t)~(ringindex_t)0 / 2 + 1);
+
+	ring->data = data;
+	ring->mask = size - 1;
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+
+bool bytering_push(ByteRing_t *ring, uint8_t byte) {
+	ringindex_t head = ring->head;
+	ringindex_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if ((ringindex_t)(head - tail) > ring->mask) {
+		return false;
+	}
+
+	ring->data[head & ring->mask] = byte;
+	__atomic_store_n(&ring->head, (ringindex_t)(head + 1), __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+ringindex_t bytering_pop(ByteRing_t *ring, uint8_t *buffer, ringindex_t len) {
+	ringindex_t tail = ring->tail;
+	ringindex_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	ringindex_t count = head - tail;
+
+	if (count > len) {
+		count = len;
+	}
+
+	for (ringindex_t i = 0; i < count; i++) {
+		buffer[i] = ring->data[(ringindex_t)(tail + i) & ring->mask];
+	}
+
+	__atomic_store_n(&ring->tail, (ringindex_t)(tail + count), __ATOMIC_RELEASE);
+
+	return count;
+}
+
+
+bool bytering_isEmpty(ByteRing_t *ring) {
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail;
+}
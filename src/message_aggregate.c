@@ -0,0 +1,134 @@
+/**
+ * @file message_aggregate.c
+ * @brief Implementation for coalescing small messages into one frame
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_aggregate.h"
+
+
+void message_aggregator_init(MessageAggregator_t *aggregator,
+							MessagePortHandle_t port,
+							uint16_t threshold,
+							uint32_t deadline) 
+{
+	assert(aggregator && port);
+
+	aggregator->port = port;
+	aggregator->threshold = (threshold > MESSAGE_AGGREGATE_SIZE) ? 
+							MESSAGE_AGGREGATE_SIZE : threshold;
+	aggregator->deadline = deadline;
+	aggregator->count = 0;
+	aggregator->length = 0;
+}
+
+
+void message_aggregate(MessageAggregator_t *aggregator,
+						const void *preamble,
+						uint8_t des,
+						uint8_t src,
+						const void *data,
+						uint16_t len,
+						uint32_t now) 
+{
+	// one length byte in front of each entry
+	if (len > 0xFF || len + 1 > MESSAGE_AGGREGATE_SIZE) {
+		message_aggregator_flush(aggregator);
+		messageport_send(aggregator->port, preamble, des, src, data, len);
+		return;
+	}
+
+	if (aggregator->count 
+		&& (des != aggregator->destination
+			|| src != aggregator->source
+			|| memcmp(preamble, aggregator->preamble, MESSAGE_PREAMBLE_SIZE)
+			|| aggregator->length + 1 + len > MESSAGE_AGGREGATE_SIZE))
+	{
+		message_aggregator_flush(aggregator);
+	}
+
+	if (aggregator->count == 0) {
+		memcpy(aggregator->preamble, preamble, MESSAGE_PREAMBLE_SIZE);
+		aggregator->destination = des;
+		aggregator->source = src;
+		aggregator->since = now;
+	}
+
+	aggregator->buffer[aggregator->length++] = (uint8_t)len;
+	memcpy(aggregator->buffer + aggregator->length, data, len);
+	aggregator->length += len;
+	aggregator->count++;
+
+	if (aggregator->length >= aggregator->threshold) {
+		message_aggregator_flush(aggregator);
+	}
+	else {
+		message_aggregator_poll(aggregator, now);
+	}
+}
+
+
+void message_aggregator_poll(MessageAggregator_t *aggregator, uint32_t now) {
+	// unsigned difference, safe across the wrap of now
+	if (aggregator->count && now - aggregator->since >= aggregator->deadline) {
+		message_aggregator_flush(aggregator);
+	}
+}
+
+
+void message_aggregator_flush(MessageAggregator_t *aggregator) {
+	if (aggregator->count == 1) {
+		// nothing to share the header with, skip the entry length
+		MessageSegment_t segment = { aggregator->buffer + 1, 
+									aggregator->length - 1 };
+
+		messageport_sendFlagged(aggregator->port, aggregator->preamble,
+								aggregator->destination, aggregator->source,
+								0, &segment, 1);
+	}
+	else if (aggregator->count > 1) {
+		MessageSegment_t segment = { aggregator->buffer, aggregator->length };
+
+		messageport_sendFlagged(aggregator->port, aggregator->preamble,
+								aggregator->destination, aggregator->source,
+								MESSAGE_AGGREGATE, &segment, 1);
+	}
+
+	aggregator->count = 0;
+	aggregator->length = 0;
+}
+
+
+uint8_t message_unpack(const Message_t *aggregate, MessageBox_t *box) {
+	Message_t message;
+	messagesize_t i = 0;
+	uint8_t count = 0;
+
+	message.address = aggregate->address;
+	message.destination = aggregate->destination;
+	// the parts keep the class of the aggregate
+	message.flags = aggregate->flags & MESSAGE_PRIORITY_MASK;
+
+	while (i < aggregate->payloadSize) {
+		uint8_t len = aggregate->payload[i++];
+
+		// a broken entry ends the list, the checksum was fine though
+		if (len > aggregate->payloadSize - i) {
+			break;
+		}
+
+		message.payloadSize = len;
+		memcpy(message.payload, aggregate->payload + i, len);
+
+		// a full box applies its overflow policy to each part
+		if (messagebox_push(box, &message) == 0) {
+			count++;
+		}
+
+		i += len;
+	}
+
+	return count;
+}
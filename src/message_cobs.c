@@ -0,0 +1,207 @@
+/**
+ * @file message_cobs.c
+ * @brief Implementation for the COBS wire format
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_cobs.h"
+
+
+/**
+ * @brief Position in the pieces of a frame: head, segs[0..n), tail.
+ */
+typedef struct Cursor {
+	const MessageSegment_t *head;
+	const MessageSegment_t *segs;
+	const MessageSegment_t *tail;
+	uint8_t n;
+	uint8_t piece; /**< @brief 0: head, 1..n: segs, n + 1: tail */
+	uint16_t offset; /**< @brief next byte in the piece */
+	uint16_t size; /**< @brief payload bytes left for segs */
+} Cursor_t;
+
+
+static const uint8_t* current(Cursor_t*, uint16_t*);
+static void emit(Cursor_t*, uint16_t, MessageWrite_t, void*);
+
+
+void message_cobs_encode(const MessageSegment_t *head,
+						const MessageSegment_t *segs,
+						uint8_t n,
+						uint16_t size,
+						const MessageSegment_t *tail,
+						MessageWrite_t write,
+						void *context)
+{
+	assert(head && tail && write);
+
+	Cursor_t cursor = { head, segs, tail, n, 0, 0, size };
+	const uint8_t delimiter = MESSAGE_COBS_DELIMITER;
+
+	for (;;) {
+		// look ahead for the end of the block: a zero, 254 bytes or the end
+		Cursor_t look = cursor;
+		uint16_t run = 0;
+		bool zero = false;
+		bool end = false;
+
+		while (run < MESSAGE_COBS_BLOCK_SIZE) {
+			uint16_t len;
+			const uint8_t *data = current(&look, &len);
+
+			if (data == NULL) {
+				end = true;
+				break;
+			}
+
+			if (len > MESSAGE_COBS_BLOCK_SIZE - run) {
+				len = MESSAGE_COBS_BLOCK_SIZE - run;
+			}
+
+			const uint8_t *found = memchr(data, 0, len);
+
+			if (found) {
+				run += found - data;
+				zero = true;
+				break;
+			}
+
+			run += len;
+			look.offset += len;
+		}
+
+		// a full block at the very end needs no empty block behind it
+		uint16_t len;
+
+		if (!zero && !end && current(&look, &len) == NULL) {
+			end = true;
+		}
+
+		uint8_t code = run + 1;
+
+		write(context, &code, 1);
+		emit(&cursor, run, write, context);
+
+		if (zero) {
+			// the zero is implied by the code
+			current(&cursor, &len);
+			cursor.offset++;
+		}
+		else if (end) {
+			break;
+		}
+	}
+
+	write(context, &delimiter, 1);
+}
+
+
+uint16_t message_cobs_encodeInPlace(uint8_t *buffer,
+									uint16_t offset,
+									uint16_t len)
+{
+	assert(buffer);
+
+	// every full block moves the output one byte closer to the input
+	if (offset < 1 + len / MESSAGE_COBS_BLOCK_SIZE) {
+		return 0;
+	}
+
+	uint16_t in = offset;
+	uint16_t end = offset + len;
+	uint16_t out = 0;
+
+	for (;;) {
+		uint16_t run = end - in;
+
+		if (run > MESSAGE_COBS_BLOCK_SIZE) {
+			run = MESSAGE_COBS_BLOCK_SIZE;
+		}
+
+		const uint8_t *found = memchr(buffer + in, 0, run);
+
+		if (found) {
+			run = found - (buffer + in);
+		}
+
+		buffer[out] = run + 1;
+		memmove(buffer + out + 1, buffer + in, run);
+		out += run + 1;
+		in += run;
+
+		if (found) {
+			in++;
+		}
+		else if (in == end) {
+			break;
+		}
+	}
+
+	buffer[out++] = MESSAGE_COBS_DELIMITER;
+
+	return out;
+}
+
+
+/**
+ * @brief bytes left in the piece under the cursor, NULL at the end.
+ */
+const uint8_t* current(Cursor_t *cursor, uint16_t *len) {
+	while (cursor->piece <= cursor->n + 1) {
+		const MessageSegment_t *piece;
+
+		if (cursor->piece == 0) {
+			piece = cursor->head;
+		}
+		else if (cursor->piece <= cursor->n) {
+			piece = &cursor->segs[cursor->piece - 1];
+		}
+		else {
+			piece = cursor->tail;
+		}
+
+		uint16_t size = piece->len;
+
+		// payload pieces are cut to the payload size
+		if (cursor->piece > 0 && cursor->piece <= cursor->n
+			&& size > cursor->size)
+		{
+			size = cursor->size;
+		}
+
+		if (cursor->offset < size) {
+			*len = size - cursor->offset;
+			return (const uint8_t*)piece->data + cursor->offset;
+		}
+
+		if (cursor->piece > 0 && cursor->piece <= cursor->n) {
+			cursor->size -= size;
+		}
+
+		cursor->piece++;
+		cursor->offset = 0;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief write count bytes from the cursor, straight out of the pieces.
+ */
+void emit(Cursor_t *cursor, uint16_t count, MessageWrite_t write, void *context) {
+	while (count) {
+		uint16_t len;
+		const uint8_t *data = current(cursor, &len);
+
+		if (len > count) {
+			len = count;
+		}
+
+		write(context, data, len);
+		cursor->offset += len;
+		count -= len;
+	}
+}
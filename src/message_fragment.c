@@ -0,0 +1,69 @@
+/**
+ * @file message_fragment.c
+ * @brief Implementation for putting fragmented payloads back together
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_fragment.h"
+
+
+void message_reassembly_init(MessageReassembly_t *context, 
+							void *buffer, 
+							uint16_t capacity) 
+{
+	assert(context && buffer);
+
+	context->buffer = buffer;
+	context->capacity = capacity;
+	context->total = 0;
+	context->received = 0;
+}
+
+
+int32_t message_reassemble(MessageReassembly_t *context, 
+							const Message_t *message) 
+{
+	if (!(message->flags & MESSAGE_FRAGMENT)) {
+		return -1;
+	}
+
+	if (message->payloadSize <= MESSAGE_FRAGMENT_HEADER_SIZE) {
+		context->total = 0;
+		return 0;
+	}
+
+	const uint8_t *header = message->payload;
+	uint16_t total = header[0] | (header[1] << 8);
+	uint16_t offset = header[2] | (header[3] << 8);
+	uint16_t len = message->payloadSize - MESSAGE_FRAGMENT_HEADER_SIZE;
+
+	// the first piece starts a new payload, whatever was in progress
+	if (offset == 0) {
+		context->total = (total <= context->capacity) ? total : 0;
+		context->received = 0;
+		context->address = message->address;
+	}
+
+	if (context->total == 0 
+		|| total != context->total
+		|| offset != context->received
+		|| message->address != context->address
+		|| len > context->total - context->received) 
+	{
+		// a piece is missing or foreign, wait for the next first piece
+		context->total = 0;
+		return 0;
+	}
+
+	memcpy(context->buffer + offset, header + MESSAGE_FRAGMENT_HEADER_SIZE, len);
+	context->received += len;
+
+	if (context->received == context->total) {
+		context->total = 0;
+		return context->received;
+	}
+
+	return 0;
+}
@@ -0,0 +1,585 @@
+/**
+ * @file message_link.c
+ * @brief Implementation for the hardware-independent part of a port
+ *
+ * Also the calls of message.h that are the same on every platform, the
+ * port files only implement opening, message_sendAsync() and polling.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_link.h"
+#include "message_fragment.h"
+#include "message_aggregate.h"
+
+
+/**
+ * @brief bytes taken out of rxRing per round, on the stack of message_poll()
+ */
+#ifndef MESSAGE_POLL_CHUNK
+#define MESSAGE_POLL_CHUNK  16
+#endif
+
+
+#if MESSAGE_RX_TIMEOUT_QUEUE & (MESSAGE_RX_TIMEOUT_QUEUE - 1)
+#error "MESSAGE_RX_TIMEOUT_QUEUE must be a power of two"
+#endif
+
+
+static uint8_t validPreamble[MESSAGE_PREAMBLE_SIZE] = {0xAA, 0xBB, 0xCC, 0xDD};
+static MessageFraming_t defaultFraming = kMessageFramingPreamble;
+static uint8_t nodeAddress;
+static uint8_t addressMask;
+static MessageNakCallback_t nakHandler;
+static MessageLink_t *defaultLink;
+
+
+static void sendFrame(MessageLink_t*, const void*, uint8_t, uint8_t, uint8_t,
+						const MessageSegment_t*, uint8_t);
+static void parseBuffer(MessageLink_t*, const uint8_t*, uint32_t);
+#if MESSAGE_STATS
+static void noteFill(MessageLink_t*);
+#endif
+
+
+void message_link_init(MessageLink_t *link,
+						Message_t *data,
+						uint8_t num,
+						const MessageLinkOps_t *ops)
+{
+	assert(link && ops && ops->write && ops->waitIdle && ops->frameGap);
+
+	message_parser_init(&link->parser, validPreamble);
+	message_parser_setFraming(&link->parser, defaultFraming);
+	message_parser_setAddress(&link->parser, nodeAddress, addressMask);
+	link->messageBox = messagebox_create(data, num);
+	link->peers = NULL;
+	link->nakHandler = nakHandler;
+	link->ops = ops;
+
+#if MESSAGE_DEFERRED
+	bytering_init(&link->rxRing, link->rxRingData, MESSAGE_RX_RING_SIZE);
+	link->rxResyncs = 0;
+	link->rxResyncsDone = 0;
+#endif
+
+#if MESSAGE_STATS
+	memset(&link->stats, 0, sizeof(link->stats));
+#endif
+}
+
+
+void message_link_setDefault(MessageLink_t *link) {
+	defaultLink = link;
+}
+
+
+MessageBoxHandle_t messageport_getBox(MessagePortHandle_t port) {
+	return &((MessageLink_t*)port)->messageBox;
+}
+
+
+void messageport_addPeer(MessagePortHandle_t port, MessagePeer_t *peer) {
+	MessageLink_t *link = port;
+
+	peer->port = port;
+	peer->next = link->peers;
+
+	// the receive path may walk the list at any time
+	__atomic_store_n(&link->peers, peer, __ATOMIC_RELEASE);
+}
+
+
+void message_setPreamble(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4) {
+	validPreamble[0] = b1;
+	validPreamble[1] = b2;
+	validPreamble[2] = b3;
+	validPreamble[3] = b4;
+
+	if (defaultLink) {
+		messageport_setPreamble(defaultLink, b1, b2, b3, b4);
+	}
+}
+
+
+void messageport_setPreamble(MessagePortHandle_t port,
+							uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+	uint8_t preamble[MESSAGE_PREAMBLE_SIZE] = { b1, b2, b3, b4 };
+
+	message_parser_setPreamble(&((MessageLink_t*)port)->parser, preamble);
+}
+
+
+void message_setFraming(MessageFraming_t framing) {
+	defaultFraming = framing;
+
+	if (defaultLink) {
+		messageport_setFraming(defaultLink, framing);
+	}
+}
+
+
+void messageport_setFraming(MessagePortHandle_t port, MessageFraming_t framing) {
+	MessageLink_t *link = port;
+
+	message_parser_setFraming(&link->parser, framing);
+
+	if (link->ops->lineFormat) {
+		link->ops->lineFormat(link);
+	}
+}
+
+
+void message_setAddress(uint8_t address, uint8_t mask) {
+	nodeAddress = address;
+	addressMask = mask;
+
+	if (defaultLink) {
+		messageport_setAddress(defaultLink, address, mask);
+	}
+}
+
+
+void messageport_setAddress(MessagePortHandle_t port,
+							uint8_t address,
+							uint8_t mask)
+{
+	MessageLink_t *link = port;
+
+	message_parser_setAddress(&link->parser, address, mask);
+
+	// the hardware address filter follows
+	if (link->ops->lineFormat) {
+		link->ops->lineFormat(link);
+	}
+}
+
+
+void message_setNakHandler(MessageNakCallback_t handler) {
+	nakHandler = handler;
+
+	if (defaultLink) {
+		messageport_setNakHandler(defaultLink, handler);
+	}
+}
+
+
+void messageport_setNakHandler(MessagePortHandle_t port, MessageNakCallback_t handler) {
+	((MessageLink_t*)port)->nakHandler = handler;
+}
+
+
+void message_send(	const void* preamble,
+					uint8_t des,
+					uint8_t src,
+					const void* data,
+					uint16_t len)
+{
+	messageport_send(defaultLink, preamble, des, src, data, len);
+}
+
+
+void message_sendv(	const void* preamble,
+					uint8_t des,
+					uint8_t src,
+					const MessageSegment_t *segs,
+					uint8_t n)
+{
+	messageport_sendv(defaultLink, preamble, des, src, segs, n);
+}
+
+
+int message_sendAsync(	const void* preamble,
+						uint8_t des,
+						uint8_t src,
+						const void* data,
+						messagesize_t len,
+						MessageSendCallback_t done)
+{
+	return messageport_sendAsync(defaultLink, preamble, des, src, data, len, done);
+}
+
+
+bool message_isSending(void) {
+	return messageport_isSending(defaultLink);
+}
+
+
+#if MESSAGE_STATS
+void message_getStats(MessageStats_t *stats) {
+	messageport_getStats(defaultLink, stats);
+}
+#endif
+
+
+void messageport_send(MessagePortHandle_t port,
+					const void* preamble,
+					uint8_t des,
+					uint8_t src,
+					const void* _data,
+					uint16_t len)
+{
+	MessageLink_t *link = port;
+	const uint8_t *data = (const uint8_t*)_data;
+
+	link->ops->waitIdle(link);
+
+	if (len <= MESSAGE_MAX_PAYLOAD_SIZE) {
+		MessageSegment_t segment = { data, len };
+
+		sendFrame(link, preamble, des, src, 0, &segment, 1);
+	}
+	else {
+		// back-to-back pieces with total length and offset in front, one
+		// gap after the last
+		for (uint32_t offset = 0; offset < len; offset += MESSAGE_FRAGMENT_SIZE) {
+			uint8_t header[MESSAGE_FRAGMENT_HEADER_SIZE] = {
+				len, len >> 8, offset, offset >> 8
+			};
+			MessageSegment_t segments[2] = {
+				{ header, sizeof(header) },
+				{ data + offset, (len - offset > MESSAGE_FRAGMENT_SIZE) ?
+								MESSAGE_FRAGMENT_SIZE : len - offset }
+			};
+
+			sendFrame(link, preamble, des, src, MESSAGE_FRAGMENT, segments, 2);
+		}
+	}
+
+	link->ops->frameGap(link);
+}
+
+
+void messageport_sendv(MessagePortHandle_t port,
+					const void* preamble,
+					uint8_t des,
+					uint8_t src,
+					const MessageSegment_t *segs,
+					uint8_t n)
+{
+	messageport_sendFlagged(port, preamble, des, src, 0, segs, n);
+}
+
+
+void messageport_sendFlagged(MessagePortHandle_t port,
+					const void* preamble,
+					uint8_t des,
+					uint8_t src,
+					uint8_t flags,
+					const MessageSegment_t *segs,
+					uint8_t n)
+{
+	MessageLink_t *link = port;
+
+	link->ops->waitIdle(link);
+	sendFrame(link, preamble, des, src, flags, segs, n);
+	link->ops->frameGap(link);
+}
+
+
+uint32_t messageport_poll(MessagePortHandle_t port) {
+	MessageLink_t *link = port;
+	uint32_t total = 0;
+	uint8_t address;
+
+#if MESSAGE_DEFERRED
+	uint8_t buffer[MESSAGE_POLL_CHUNK];
+	ringindex_t n;
+
+	do {
+		ringindex_t len = sizeof(buffer);
+
+		uint8_t done = link->rxResyncsDone;
+
+		// each resync in turn, the bytes in front of it still belong to
+		// the frame it drops
+		while (__atomic_load_n(&link->rxResyncs, __ATOMIC_ACQUIRE) != done) {
+			ringindex_t left = link->rxResyncAt[done & (MESSAGE_RX_TIMEOUT_QUEUE - 1)]
+								- link->rxRing.tail;
+
+			if (left) {
+				len = (left < len) ? left : len;
+				break;
+			}
+
+			// taken by the feed of the byte at this position
+			message_parser_resync(&link->parser);
+			__atomic_store_n(&link->rxResyncsDone, ++done, __ATOMIC_RELEASE);
+		}
+
+		n = bytering_pop(&link->rxRing, buffer, len);
+		parseBuffer(link, buffer, n);
+
+		total += n;
+	} while (n > 0);
+#endif
+
+	// sent from here, the receive path must not wait for the line
+	if (messagebox_takeNak(&link->messageBox, &address)) {
+		messageport_sendFlagged(link, link->parser.validPreamble, address,
+								link->parser.nodeAddress, MESSAGE_NAK, NULL, 0);
+	}
+
+	return total;
+}
+
+
+uint16_t message_link_createFrame(MessageLink_t *link,
+						const void *_preamble,
+						uint8_t des,
+						uint8_t src,
+						const void *_data,
+						messagesize_t len)
+{
+	MessageFrame_t *txFrame = &link->txFrame;
+	uint8_t* preamble = (uint8_t*)_preamble;
+	uint8_t* data = (uint8_t*)_data;
+
+	// PREAMBLE
+	for (uint8_t i = 0; i < MESSAGE_PREAMBLE_SIZE; i++) {
+		txFrame->preamble[i] = preamble[i];
+	}
+
+	// ADDRESS
+	txFrame->address[0] = des;
+	txFrame->address[1] = src;
+
+	// PAYLOAD SIZE
+	txFrame->payloadSize = (len > MESSAGE_MAX_PAYLOAD_SIZE) ?
+							MESSAGE_MAX_PAYLOAD_SIZE : len;
+
+	// PAYLOAD
+	memcpy(txFrame->payload, data, txFrame->payloadSize);
+
+
+	// CHECKSUM CRC32, stored right behind the payload so the frame is
+	// one contiguous buffer
+	// COBS and 9-bit frames are checksummed without preamble
+	uint8_t skip = (link->parser.framing != kMessageFramingPreamble) ?
+					sizeof(txFrame->preamble) : 0;
+
+	crc32_t checksum = crc32_concat(crc32_compute((uint8_t*)txFrame + skip,
+											sizeof(txFrame->preamble) - skip
+											+ sizeof(txFrame->address)
+											+ sizeof(txFrame->payloadSize)),
+								txFrame->payload, txFrame->payloadSize);
+
+	uint16_t length = sizeof(txFrame->preamble) + sizeof(txFrame->address)
+					+ sizeof(txFrame->payloadSize) + txFrame->payloadSize;
+
+	memcpy((uint8_t*)txFrame + length, &checksum, sizeof(crc32_t));
+
+	if (link->parser.framing == kMessageFramingCOBS) {
+		// encoded over the preamble, 0 if the frame is too long for that
+		return message_cobs_encodeInPlace((uint8_t*)txFrame, skip,
+										length - skip + sizeof(crc32_t));
+	}
+
+	return length + sizeof(crc32_t);
+}
+
+
+void message_link_receive(MessageLink_t *link, const uint8_t *data, uint32_t len) {
+#if MESSAGE_DEFERRED
+	for (uint32_t i = 0; i < len; i++) {
+		// a full ring drops the byte, like a hardware overrun
+		if (!bytering_push(&link->rxRing, data[i])) {
+#if MESSAGE_STATS
+			link->stats.overruns++;
+#endif
+		}
+	}
+#else
+	parseBuffer(link, data, len);
+#endif
+}
+
+
+void message_link_resync(MessageLink_t *link) {
+#if MESSAGE_DEFERRED
+	uint8_t count = link->rxResyncs;
+	uint8_t done = __atomic_load_n(&link->rxResyncsDone, __ATOMIC_ACQUIRE);
+
+	// the slot is written before it is published and only reused once
+	// message_poll() is done with it
+	if ((uint8_t)(count - done) < MESSAGE_RX_TIMEOUT_QUEUE) {
+		// message_poll() drops the frame once it has parsed up to here
+		link->rxResyncAt[count & (MESSAGE_RX_TIMEOUT_QUEUE - 1)] = link->rxRing.head;
+		__atomic_store_n(&link->rxResyncs, count + 1, __ATOMIC_RELEASE);
+	}
+#else
+	message_parser_timeout(&link->parser);
+#endif
+}
+
+
+#if MESSAGE_STATS
+void message_link_getStats(MessageLink_t *link, MessageStats_t *stats) {
+	MessageBoxCounters_t counters;
+
+	*stats = link->stats;
+	stats->rxBytes = link->parser.bytes;
+	stats->rxFrames = link->parser.frames;
+	stats->crcErrors = link->parser.crcErrors;
+	stats->resyncs = link->parser.resyncs;
+	stats->truncated = link->parser.truncated;
+	stats->filtered = link->parser.filtered;
+
+	messagebox_getCounters(&link->messageBox, &counters);
+	stats->dropped = counters.dropped;
+	stats->overwritten = counters.overwritten;
+	stats->rejected = counters.rejected;
+}
+#endif
+
+
+#if MESSAGE_ISR_HISTOGRAM
+void message_link_isrTime(MessageLink_t *link, uint32_t time) {
+	uint8_t bin = 0;
+
+	// bin i: 2^i to 2^(i+1) - 1, the last one takes the rest
+	while ((time >>= 1) && bin < MESSAGE_HISTOGRAM_BINS - 1) {
+		bin++;
+	}
+
+	link->stats.isrTime[bin]++;
+}
+#endif
+
+
+/**
+ * @brief Send one frame through the write hooks, without frame gap.
+ *
+ * The caller waits for a message_sendAsync() in progress first.
+ */
+void sendFrame(MessageLink_t *link,
+				const void *_preamble,
+				uint8_t des,
+				uint8_t src,
+				uint8_t flags,
+				const MessageSegment_t *segs,
+				uint8_t n)
+{
+	uint8_t header[MESSAGE_PREAMBLE_SIZE + 2 + sizeof(messagesize_t) + 1];
+	uint8_t headerSize = sizeof(header) - (flags ? 0 : 1);
+	// the flags byte is the first payload byte
+	messagesize_t room = MESSAGE_MAX_PAYLOAD_SIZE - (flags ? 1 : 0);
+	messagesize_t size = 0;
+
+	for (uint8_t i = 0; i < n; i++) {
+		size = (segs[i].len > room - size) ? room : size + segs[i].len;
+	}
+
+	messagesize_t field = flags ? (size + 1) | MESSAGE_SIZE_FLAGS : size;
+
+	memcpy(header, _preamble, MESSAGE_PREAMBLE_SIZE);
+	header[MESSAGE_PREAMBLE_SIZE] = des;
+	header[MESSAGE_PREAMBLE_SIZE + 1] = src;
+
+	// 1 or 2 bytes, little-endian
+	for (uint8_t i = 0; i < sizeof(messagesize_t); i++) {
+		header[MESSAGE_PREAMBLE_SIZE + 2 + i] = (uint8_t)(field >> (8 * i));
+	}
+
+	header[MESSAGE_PREAMBLE_SIZE + 2 + sizeof(messagesize_t)] = flags;
+
+#if MESSAGE_STATS
+	link->stats.txFrames++;
+#endif
+
+	// no preamble in front of the address character either
+	uint8_t skip = (link->parser.framing != kMessageFramingPreamble) ?
+					MESSAGE_PREAMBLE_SIZE : 0;
+
+	if (link->parser.framing == kMessageFramingCOBS) {
+		// no preamble, the checksum goes through the encoder as well
+		MessageSegment_t head = { header + skip, headerSize - skip };
+		crc32_t checksum = crc32_compute(head.data, head.len);
+		MessageSegment_t tail = { &checksum, sizeof(crc32_t) };
+		messagesize_t left = size;
+
+		for (uint8_t i = 0; i < n && left; i++) {
+			messagesize_t len = (segs[i].len > left) ? left : segs[i].len;
+
+			checksum = crc32_concat(checksum, segs[i].data, len);
+			left -= len;
+		}
+
+		message_cobs_encode(&head, segs, n, size, &tail, link->ops->write, link);
+		return;
+	}
+
+	// each segment is checksummed right before it goes out, no copy
+	crc32_t checksum = crc32_compute(header + skip, headerSize - skip);
+
+	if (link->parser.framing == kMessageFramingAddress && link->ops->writeAddress) {
+		link->ops->writeAddress(link, des);
+		skip++;
+	}
+
+	link->ops->write(link, header + skip, headerSize - skip);
+
+	for (uint8_t i = 0; i < n && size; i++) {
+		messagesize_t len = (segs[i].len > size) ? size : segs[i].len;
+
+		checksum = crc32_concat(checksum, segs[i].data, len);
+		link->ops->write(link, segs[i].data, len);
+		size -= len;
+	}
+
+	link->ops->write(link, &checksum, sizeof(crc32_t));
+}
+
+
+void parseBuffer(MessageLink_t *link, const uint8_t *data, uint32_t len) {
+	while (len) {
+		uint32_t n = message_parser_feed(&link->parser, data, len);
+		const Message_t *message = message_parser_getMessage(&link->parser);
+
+		if (message && (message->flags & MESSAGE_NAK)) {
+			if (link->nakHandler) {
+				// the link is the first member of its port
+				link->nakHandler(link, message->address);
+			}
+		}
+		else if (message && (message->flags & MESSAGE_AGGREGATE)) {
+			message_unpack(message, &link->messageBox);
+		}
+		else if (message && (message->flags & (MESSAGE_RELIABLE | MESSAGE_ACK))) {
+			message_peer_receive(__atomic_load_n(&link->peers, __ATOMIC_ACQUIRE),
+								message, &link->messageBox);
+		}
+		else if (message) {
+			messagebox_push(&link->messageBox, message);
+		}
+
+#if MESSAGE_STATS
+		if (message) {
+			noteFill(link);
+		}
+#endif
+
+		data += n;
+		len -= n;
+	}
+}
+
+
+#if MESSAGE_STATS
+/**
+ * @brief keep the fullest lane, sampled after each frame.
+ */
+void noteFill(MessageLink_t *link) {
+	MessageBox_t *box = &link->messageBox;
+
+	for (uint8_t i = 0; i <= box->laneCount; i++) {
+		uint8_t used = messagebox_getUsedSpace(i ? &box->lanes[i - 1] : box);
+
+		if (used > link->stats.boxHighWater) {
+			link->stats.boxHighWater = used;
+		}
+	}
+}
+#endif
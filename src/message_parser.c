@@ -0,0 +1,556 @@
+/**
+ * @file message_parser.c
+ * @brief Implementation for the transport-independent frame parser
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_parser.h"
+#include "message_cobs.h"
+
+#if MESSAGE_PREAMBLE_SCAN
+#include "preamble_scan.h"
+#endif
+
+
+#if MESSAGE_STATS
+#define COUNT(counter, n)   ((counter) += (n))
+#else
+#define COUNT(counter, n)
+#endif
+
+
+typedef enum step {	kParsingPreamble = 0,
+					kParsingAddress,
+					kParsingSize,
+					kParsingFlags,
+					kParsingPayload,
+					kParsingChecksum,
+					kSkippingFrame
+} step_t;
+
+
+static uint32_t parseFrame(MessageParser_t*, const uint8_t*, uint32_t);
+static uint32_t feedPreamble(MessageParser_t*, const uint8_t*, uint32_t);
+static uint32_t feedCOBS(MessageParser_t*, const uint8_t*, uint32_t);
+static uint32_t feedAddressed(MessageParser_t*, const uint8_t*, uint32_t);
+static void startFrame(MessageParser_t*);
+static uint8_t fallBack(MessageParser_t*, uint8_t);
+static bool inFrame(const MessageParser_t*);
+static void skipped(MessageParser_t*, uint32_t);
+static void synced(MessageParser_t*);
+#if MESSAGE_PREAMBLE_SCAN
+static uint8_t matchTail(MessageParser_t*, const uint8_t*, uint32_t);
+#endif
+
+
+void message_parser_init(MessageParser_t *parser, const void *preamble) {
+	assert(parser && preamble);
+
+	parser->step = kParsingPreamble;
+	parser->framing = kMessageFramingPreamble;
+	parser->counter = 0;
+	parser->ready = false;
+	parser->resync = false;
+	parser->nodeAddress = 0;
+	parser->addressMask = 0;
+#if MESSAGE_STATS
+	parser->bytes = 0;
+	parser->frames = 0;
+	parser->crcErrors = 0;
+	parser->truncated = 0;
+	parser->filtered = 0;
+	parser->resyncs = 0;
+	parser->hunting = false;
+#endif
+
+	message_parser_setPreamble(parser, preamble);
+}
+
+
+void message_parser_setFraming(MessageParser_t *parser, MessageFraming_t framing) {
+	parser->framing = framing;
+
+	// take the line as idle, a bad start is dropped at the first 0x00
+	message_parser_timeout(parser);
+}
+
+
+void message_parser_setAddress(MessageParser_t *parser, 
+								uint8_t address, 
+								uint8_t mask) 
+{
+	parser->nodeAddress = address;
+	parser->addressMask = mask;
+}
+
+
+void message_parser_setPreamble(MessageParser_t *parser, const void *preamble) {
+	memcpy(parser->validPreamble, preamble, MESSAGE_PREAMBLE_SIZE);
+
+	parser->preambleChecksum = crc32_compute(parser->validPreamble, 
+											MESSAGE_PREAMBLE_SIZE);
+}
+
+
+uint32_t message_parser_feed(MessageParser_t *parser, 
+							const void *_data, 
+							uint32_t len) 
+{
+	const uint8_t *data = (const uint8_t*)_data;
+	uint32_t n;
+
+	parser->ready = false;
+
+	if (parser->resync) {
+		parser->resync = false;
+		message_parser_timeout(parser);
+	}
+
+	if (parser->framing == kMessageFramingCOBS) {
+		n = feedCOBS(parser, data, len);
+	}
+	else if (parser->framing == kMessageFramingAddress) {
+		n = feedAddressed(parser, data, len);
+	}
+	else {
+		n = feedPreamble(parser, data, len);
+	}
+
+	// the caller feeds the rest again after a frame
+	COUNT(parser->bytes, n);
+
+	return n;
+}
+
+
+const Message_t* message_parser_getMessage(MessageParser_t *parser) {
+	return parser->ready ? &parser->message : NULL;
+}
+
+
+void message_parser_timeout(MessageParser_t *parser) {
+	if (inFrame(parser)) {
+		COUNT(parser->resyncs, 1);
+	}
+
+	if (parser->framing == kMessageFramingCOBS) {
+		startFrame(parser);
+	}
+	else {
+		parser->counter = 0;
+		parser->step = kParsingPreamble;
+	}
+}
+
+
+void message_parser_resync(MessageParser_t *parser) {
+	parser->resync = true;
+}
+
+
+bool message_parser_accepts(const MessageParser_t *parser, uint8_t destination) {
+	return destination == MESSAGE_BROADCAST
+			|| ((destination ^ parser->nodeAddress) & parser->addressMask) == 0;
+}
+
+
+bool message_parser_isIdle(const MessageParser_t *parser) {
+	return parser->step == kParsingPreamble && parser->counter == 0;
+}
+
+
+/**
+ * @brief parse the fields behind the preamble, up to the checksum.
+ *
+ * Returns once the frame is complete (step back to kParsingPreamble) or
+ * the data is used up.
+ */
+uint32_t parseFrame(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	uint32_t i = 0;
+
+	while (i < len && parser->step != kParsingPreamble) {
+		switch (parser->step) {
+			case kParsingAddress:
+				if (parser->counter++ == 0) {
+					parser->message.destination = data[i];
+				}
+				else {
+					parser->message.address = data[i];
+					parser->counter = 0;
+					parser->size = 0;
+					parser->step = kParsingSize;
+				}
+
+				parser->runningChecksum = crc32_concatByte(parser->runningChecksum, 
+															data[i++]);
+				break;
+
+			case kParsingSize:
+				// 1 or 2 bytes, little-endian
+				parser->size |= (messagesize_t)data[i] << (8 * parser->counter++);
+				parser->runningChecksum = crc32_concatByte(parser->runningChecksum, 
+															data[i++]);
+
+				if (parser->counter == sizeof(messagesize_t)) {
+					messagesize_t size = parser->size & ~MESSAGE_SIZE_FLAGS;
+
+					parser->counter = 0;
+					parser->message.flags = 0;
+					parser->message.payloadSize = (size > MESSAGE_MAX_PAYLOAD_SIZE) ?
+												MESSAGE_MAX_PAYLOAD_SIZE : size;
+
+					if (size > MESSAGE_MAX_PAYLOAD_SIZE) {
+						COUNT(parser->truncated, 1);
+					}
+
+					// not for this node: skip the rest unparsed
+					if (!message_parser_accepts(parser, parser->message.destination)) {
+						COUNT(parser->filtered, 1);
+
+						if (parser->framing == kMessageFramingCOBS) {
+							// up to the next delimiter
+							parser->step = kParsingPreamble;
+						}
+						else {
+							parser->counter = parser->message.payloadSize 
+												+ sizeof(crc32_t);
+							parser->step = kSkippingFrame;
+						}
+					}
+					// an empty payload is followed by the checksum right away
+					else if (parser->message.payloadSize == 0) {
+						parser->step = kParsingChecksum;
+					}
+					else if (parser->size & MESSAGE_SIZE_FLAGS) {
+						parser->step = kParsingFlags;
+					}
+					else {
+						parser->step = kParsingPayload;
+					}
+				}
+				break;
+
+			case kParsingFlags:
+				// first payload byte, not part of Message_t::payload
+				parser->message.flags = data[i];
+				parser->message.payloadSize--;
+				parser->runningChecksum = crc32_concatByte(parser->runningChecksum, 
+															data[i++]);
+
+				parser->step = parser->message.payloadSize ? 
+								kParsingPayload : kParsingChecksum;
+				break;
+
+			case kParsingPayload: {
+				// take as much of the payload as this buffer holds at once
+				uint32_t n = parser->message.payloadSize - parser->counter;
+
+				if (n > len - i) {
+					n = len - i;
+				}
+
+				memcpy(parser->message.payload + parser->counter, data + i, n);
+				parser->runningChecksum = crc32_concat(parser->runningChecksum, 
+														data + i, n);
+				parser->counter += n;
+				i += n;
+
+				if (parser->counter == parser->message.payloadSize) {
+					parser->counter = 0;
+					parser->step = kParsingChecksum;
+				}
+				break;
+			}
+
+			case kParsingChecksum:
+				parser->checksum[parser->counter++] = data[i++];
+
+				if (parser->counter == sizeof(crc32_t)) {
+					crc32_t checksum;
+
+					memcpy(&checksum, parser->checksum, sizeof(crc32_t));
+
+					parser->counter = 0;
+					parser->step = kParsingPreamble;
+
+					// header and payload were checksummed while they arrived
+					if (checksum == parser->runningChecksum) {
+						COUNT(parser->frames, 1);
+						parser->ready = true;
+						return i;
+					}
+
+					COUNT(parser->crcErrors, 1);
+				}
+				break;
+
+			case kSkippingFrame: {
+				uint32_t n = parser->counter;
+
+				if (n > len - i) {
+					n = len - i;
+				}
+
+				parser->counter -= n;
+				i += n;
+
+				if (parser->counter == 0) {
+					parser->step = kParsingPreamble;
+				}
+				break;
+			}
+		}
+	}
+
+	return i;
+}
+
+
+/**
+ * @brief parse frames starting with the preamble.
+ */
+uint32_t feedPreamble(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	uint32_t i = 0;
+
+	while (i < len) {
+		if (parser->step != kParsingPreamble) {
+			i += parseFrame(parser, data + i, len - i);
+
+			if (parser->ready) {
+				return i;
+			}
+			continue;
+		}
+
+		if (parser->counter == 0) {
+#if MESSAGE_PREAMBLE_SCAN
+			// skip everything that cannot start a frame, many bytes 
+			// per compare
+			uint32_t start;
+
+			if (preamble_scan(data + i, len - i, parser->validPreamble, 
+								&start, 1) == 0) 
+			{
+				parser->counter = matchTail(parser, data + i, len - i);
+				skipped(parser, len - i - parser->counter);
+				return len;
+			}
+
+			skipped(parser, start);
+			i += start + MESSAGE_PREAMBLE_SIZE;
+			parser->counter = MESSAGE_PREAMBLE_SIZE;
+#else
+			// skip everything that cannot start a frame
+			const uint8_t *start = memchr(data + i, 
+										parser->validPreamble[0], 
+										len - i);
+			if (start == NULL) {
+				skipped(parser, len - i);
+				return len;
+			}
+
+			skipped(parser, start - (data + i));
+			i = start - data + 1;
+			parser->counter = 1;
+#endif
+		}
+		else if (data[i] == parser->validPreamble[parser->counter]) {
+			i++;
+			parser->counter++;
+		}
+		else {
+			// keep the longest part still matching, 55 55 55 55 D5
+			// must not lose the frame on preamble 55 55 55 D5
+			parser->counter = fallBack(parser, data[i++]);
+			skipped(parser, 1);
+		}
+
+		// go to next step if 4-byte preamble is read.
+		if (parser->counter == MESSAGE_PREAMBLE_SIZE) {
+			synced(parser);
+			parser->counter = 0;
+			parser->runningChecksum = parser->preambleChecksum;
+			parser->step = kParsingAddress;
+		}
+	}
+
+	return i;
+}
+
+
+/**
+ * @brief decode COBS on the fly and parse the decoded bytes.
+ *
+ * kParsingPreamble stands for waiting for the next delimiter here.
+ */
+uint32_t feedCOBS(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	static const uint8_t zero = 0;
+	uint32_t i = 0;
+
+	while (i < len) {
+		if (data[i] == MESSAGE_COBS_DELIMITER) {
+			// end of frame, whatever is left of it is dropped
+			if (inFrame(parser)) {
+				COUNT(parser->resyncs, 1);
+			}
+
+			i++;
+			startFrame(parser);
+		}
+		else if (parser->cobsCode == 0) {
+			// code byte: zero ending the previous block, length of this one
+			uint8_t code = data[i++];
+
+			if (parser->cobsZero && parser->step != kParsingPreamble) {
+				parseFrame(parser, &zero, 1);
+			}
+
+			parser->cobsCode = code - 1;
+			parser->cobsZero = (code != 0xFF);
+
+			if (parser->ready) {
+				return i;
+			}
+		}
+		else {
+			// a run of data bytes, decoded as they are
+			uint32_t n = (len - i > parser->cobsCode) ? parser->cobsCode : len - i;
+			const uint8_t *end = memchr(data + i, MESSAGE_COBS_DELIMITER, n);
+
+			if (end) {
+				n = end - (data + i);
+			}
+
+			if (parser->step != kParsingPreamble) {
+				n = parseFrame(parser, data + i, n);
+			}
+
+			parser->cobsCode -= n;
+			i += n;
+
+			if (parser->ready) {
+				return i;
+			}
+		}
+	}
+
+	return i;
+}
+
+
+/**
+ * @brief parse frames sent back to back, each starting with its address.
+ *
+ * The 9th bit is seen by the UART only, the parser counts on the length
+ * field and the line timeout to find the next frame.
+ */
+uint32_t feedAddressed(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	uint32_t i = 0;
+
+	while (i < len) {
+		if (parser->step == kParsingPreamble) {
+			startFrame(parser);
+		}
+
+		i += parseFrame(parser, data + i, len - i);
+
+		if (parser->ready) {
+			return i;
+		}
+	}
+
+	return i;
+}
+
+
+/**
+ * @brief expect a frame without preamble (COBS, 9-bit address mode).
+ */
+void startFrame(MessageParser_t *parser) {
+	parser->counter = 0;
+	parser->cobsCode = 0;
+	parser->cobsZero = false;
+	parser->runningChecksum = 0;
+	parser->step = kParsingAddress;
+}
+
+
+/**
+ * @brief note bytes dropped while looking for the preamble.
+ */
+void skipped(MessageParser_t *parser, uint32_t n) {
+#if MESSAGE_STATS
+	if (n) {
+		parser->hunting = true;
+	}
+#else
+	(void)parser;
+	(void)n;
+#endif
+}
+
+
+/**
+ * @brief a preamble is complete, count it if noise came first.
+ */
+void synced(MessageParser_t *parser) {
+#if MESSAGE_STATS
+	if (parser->hunting) {
+		parser->hunting = false;
+		parser->resyncs++;
+	}
+#else
+	(void)parser;
+#endif
+}
+
+
+/**
+ * @brief a frame is partly parsed, dropping it loses data.
+ */
+bool inFrame(const MessageParser_t *parser) {
+	return parser->counter != 0 
+			|| (parser->step != kParsingPreamble && parser->step != kParsingAddress);
+}
+
+
+/**
+ * @brief length of the longest preamble prefix ending a partial match
+ * followed by a mismatching byte.
+ */
+uint8_t fallBack(MessageParser_t *parser, uint8_t byte) {
+	uint8_t seen[MESSAGE_PREAMBLE_SIZE];
+	uint8_t len = parser->counter + 1;
+
+	memcpy(seen, parser->validPreamble, parser->counter);
+	seen[parser->counter] = byte;
+
+	for (uint8_t n = len - 1; n > 0; n--) {
+		if (memcmp(seen + len - n, parser->validPreamble, n) == 0) {
+			return n;
+		}
+	}
+
+	return 0;
+}
+
+
+#if MESSAGE_PREAMBLE_SCAN
+/**
+ * @brief length of the longest preamble prefix ending the buffer.
+ *
+ * The scanner only reports complete preambles, the rest of one cut by the
+ * end of the buffer arrives with the next call.
+ */
+uint8_t matchTail(MessageParser_t *parser, const uint8_t *data, uint32_t len) {
+	for (uint8_t n = MESSAGE_PREAMBLE_SIZE - 1; n > 0; n--) {
+		if (n <= len && memcmp(data + len - n, parser->validPreamble, n) == 0) {
+			return n;
+		}
+	}
+
+	return 0;
+}
+#endif
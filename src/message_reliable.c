@@ -0,0 +1,310 @@
+/**
+ * @file message_reliable.c
+ * @brief Implementation for reliable delivery to a peer
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "message_reliable.h"
+
+
+/**
+ * @brief bytes of the selective bitmap in an ACK
+ */
+#define ACK_BITS_SIZE   ((MESSAGE_WINDOW_MAX + 7) / 8)
+
+
+static void transmit(MessagePeer_t*, uint8_t);
+static void sendAck(MessagePeer_t*);
+static void applyAck(MessagePeer_t*);
+static void takeFrame(MessagePeer_t*, const Message_t*, MessageBox_t*);
+static void takeAck(MessagePeer_t*, const Message_t*);
+static void beginWrite(uint8_t*);
+static void endWrite(uint8_t*);
+
+
+void message_peer_init(MessagePeer_t *peer,
+						const void *preamble,
+						uint8_t source,
+						uint8_t address,
+						Message_t *slots,
+						uint8_t window,
+						uint32_t timeout)
+{
+	assert(peer && preamble && slots);
+	// the slot of a sequence number is its low bits
+	assert(window && window <= MESSAGE_WINDOW_MAX
+			&& (window & (window - 1)) == 0);
+
+	memcpy(peer->preamble, preamble, MESSAGE_PREAMBLE_SIZE);
+	peer->port = NULL;
+	peer->next = NULL;
+	peer->source = source;
+	peer->address = address;
+	peer->window = window;
+	peer->timeout = timeout;
+	peer->txSlots = slots;
+	peer->rxSlots = slots + window;
+	peer->txBase = 0;
+	peer->txNext = 0;
+	peer->txAcked = 0;
+	peer->rxVersion = 0;
+	peer->rxNext = 0;
+	peer->rxHave = 0;
+	peer->ackDue = false;
+	peer->ackVersion = 0;
+	peer->ackSeen = 0;
+}
+
+
+int message_sendReliable(MessagePeer_t *peer,
+						const void *data,
+						uint16_t len,
+						uint32_t now)
+{
+	assert(peer->port);
+
+	applyAck(peer);
+
+	if (len > MESSAGE_RELIABLE_SIZE
+		|| (uint8_t)(peer->txNext - peer->txBase) >= peer->window)
+	{
+		return -1;
+	}
+
+	uint8_t slot = peer->txNext & (peer->window - 1);
+	Message_t *frame = &peer->txSlots[slot];
+
+	// kept as sent: sequence number, then the message
+	frame->payload[0] = peer->txNext;
+	memcpy(frame->payload + 1, data, len);
+	frame->payloadSize = len + 1;
+
+	peer->txAcked &= ~(1UL << (uint8_t)(peer->txNext - peer->txBase));
+	peer->sentAt[slot] = now;
+	peer->txNext++;
+
+	transmit(peer, slot);
+
+	return 0;
+}
+
+
+void message_peer_poll(MessagePeer_t *peer, uint32_t now) {
+	applyAck(peer);
+
+	for (uint8_t i = 0; i < (uint8_t)(peer->txNext - peer->txBase); i++) {
+		uint8_t slot = (peer->txBase + i) & (peer->window - 1);
+
+		// unsigned difference, safe across the wrap of now
+		if (!(peer->txAcked & (1UL << i))
+			&& now - peer->sentAt[slot] >= peer->timeout)
+		{
+			peer->sentAt[slot] = now;
+			transmit(peer, slot);
+		}
+	}
+
+	if (__atomic_load_n(&peer->ackDue, __ATOMIC_ACQUIRE)) {
+		// cleared first, a frame arriving meanwhile asks again
+		__atomic_store_n(&peer->ackDue, false, __ATOMIC_RELEASE);
+		sendAck(peer);
+	}
+}
+
+
+uint8_t message_peer_inFlight(MessagePeer_t *peer) {
+	applyAck(peer);
+
+	return peer->txNext - peer->txBase;
+}
+
+
+void message_peer_receive(MessagePeer_t *peers,
+						const Message_t *message,
+						MessageBox_t *box)
+{
+	MessagePeer_t *peer = peers;
+
+	while (peer && peer->address != message->address) {
+		peer = peer->next;
+	}
+
+	if (peer == NULL) {
+		return;
+	}
+
+	if (message->flags & MESSAGE_ACK) {
+		takeAck(peer, message);
+	}
+	else if (message->payloadSize) {
+		takeFrame(peer, message, box);
+	}
+}
+
+
+/**
+ * @brief send the frame in a txSlot (again).
+ */
+void transmit(MessagePeer_t *peer, uint8_t slot) {
+	MessageSegment_t segment = { peer->txSlots[slot].payload,
+								peer->txSlots[slot].payloadSize };
+
+	messageport_sendFlagged(peer->port, peer->preamble, peer->address,
+							peer->source, MESSAGE_RELIABLE, &segment, 1);
+}
+
+
+/**
+ * @brief acknowledge what the receive side holds right now.
+ */
+void sendAck(MessagePeer_t *peer) {
+	uint8_t version;
+	uint8_t next;
+	uint32_t have;
+
+	// retry if the receive side changed the state while it was read
+	do {
+		version = __atomic_load_n(&peer->rxVersion, __ATOMIC_ACQUIRE);
+		next = peer->rxNext;
+		have = peer->rxHave;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((version & 1)
+			|| version != __atomic_load_n(&peer->rxVersion, __ATOMIC_RELAXED));
+
+	// bit 0 is next itself, only held back by a full box
+	uint32_t bits = have >> 1;
+	uint8_t payload[1 + ACK_BITS_SIZE];
+
+	payload[0] = next;
+
+	for (uint8_t i = 0; i < ACK_BITS_SIZE; i++) {
+		payload[1 + i] = (uint8_t)(bits >> (8 * i));
+	}
+
+	MessageSegment_t segment = { payload, sizeof(payload) };
+
+	messageport_sendFlagged(peer->port, peer->preamble, peer->address,
+							peer->source, MESSAGE_ACK, &segment, 1);
+}
+
+
+/**
+ * @brief slide the window by the last ACK the receive side stored.
+ */
+void applyAck(MessagePeer_t *peer) {
+	uint8_t version;
+	uint8_t next;
+	uint32_t bits;
+
+	do {
+		version = __atomic_load_n(&peer->ackVersion, __ATOMIC_ACQUIRE);
+		next = peer->ackNext;
+		bits = peer->ackBits;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((version & 1)
+			|| version != __atomic_load_n(&peer->ackVersion, __ATOMIC_RELAXED));
+
+	if (version == peer->ackSeen) {
+		return;
+	}
+
+	peer->ackSeen = version;
+
+	uint8_t inFlight = peer->txNext - peer->txBase;
+	uint8_t acked = next - peer->txBase;
+
+	// an old ACK, overtaken by a later one
+	if (acked > inFlight) {
+		return;
+	}
+
+	peer->txBase = next;
+	peer->txAcked = (acked < 32) ? peer->txAcked >> acked : 0;
+	// next itself is due again even if held: a full box keeps it back
+	// until the retransmission arrives
+	peer->txAcked &= ~1UL;
+	// bit i of the ACK is next + 1 + i
+	peer->txAcked |= bits << 1;
+}
+
+
+/**
+ * @brief store a data frame, deliver what is in order (receive side).
+ */
+void takeFrame(MessagePeer_t *peer, const Message_t *message, MessageBox_t *box) {
+	uint8_t ahead = message->payload[0] - peer->rxNext;
+
+	beginWrite(&peer->rxVersion);
+
+	// anything else is a retransmission of a delivered frame, its ACK
+	// got lost
+	if (ahead < peer->window && !(peer->rxHave & (1UL << ahead))) {
+		Message_t *frame = &peer->rxSlots[message->payload[0]
+											& (peer->window - 1)];
+
+		frame->address = message->address;
+		frame->destination = message->destination;
+		// the priority picks the lane of the message box
+		frame->flags = MESSAGE_RELIABLE | (message->flags & MESSAGE_PRIORITY_MASK);
+		frame->payloadSize = message->payloadSize - 1;
+		memcpy(frame->payload, message->payload + 1, frame->payloadSize);
+
+		peer->rxHave |= 1UL << ahead;
+	}
+
+	// a full lane holds the rest back unacknowledged
+	while (peer->rxHave & 1) {
+		Message_t *frame = &peer->rxSlots[peer->rxNext & (peer->window - 1)];
+
+		if (messagebox_isFull(messagebox_getLane(box, frame))) {
+			break;
+		}
+
+		messagebox_push(box, frame);
+		peer->rxHave >>= 1;
+		peer->rxNext++;
+	}
+
+	endWrite(&peer->rxVersion);
+	__atomic_store_n(&peer->ackDue, true, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief store an ACK for the send side (receive side).
+ */
+void takeAck(MessagePeer_t *peer, const Message_t *message) {
+	uint32_t bits = 0;
+
+	if (message->payloadSize == 0) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < ACK_BITS_SIZE && 1 + i < message->payloadSize; i++) {
+		bits |= (uint32_t)message->payload[1 + i] << (8 * i);
+	}
+
+	beginWrite(&peer->ackVersion);
+	peer->ackNext = message->payload[0];
+	peer->ackBits = bits;
+	endWrite(&peer->ackVersion);
+}
+
+
+/**
+ * @brief make a version odd before the fields it guards change.
+ */
+void beginWrite(uint8_t *version) {
+	__atomic_store_n(version, *version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief make a version even again, the fields are consistent.
+ */
+void endWrite(uint8_t *version) {
+	__atomic_store_n(version, *version + 1, __ATOMIC_RELEASE);
+}
@@ -9,12 +9,120 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
 #include "messagebox.h"
 #include "message.h"
 
 
+/**
+ * @brief next value of a read/write point.
+ */
+static uint8_t advance(const MessageBox_t *box, uint8_t point) {
+	// power of two: free-running, 256 is a multiple of the capacity
+	if (box->mask) {
+		return point + 1;
+	}
+
+	return (point + 1 == 2 * box->capacity) ? 0 : point + 1;
+}
+
+
+/**
+ * @brief slot in the data array for a read/write point.
+ */
+static uint8_t slot(const MessageBox_t *box, uint8_t point) {
+	if (box->mask) {
+		return point & box->mask;
+	}
+
+	return (point >= box->capacity) ? point - box->capacity : point;
+}
+
+
+/**
+ * @brief number of stored messages between two points.
+ */
+static uint8_t distance(const MessageBox_t *box, uint8_t read, uint8_t write) {
+	if (box->mask || write >= read) {
+		return write - read;
+	}
+
+	return write + 2 * box->capacity - read;
+}
+
+
+/**
+ * @brief move readPoint on from read, unless the other side did first.
+ */
+static bool moveRead(MessageBox_t *box, uint8_t read) {
+	uint8_t next = advance(box, read);
+
+#ifdef __AVR__
+	// no compare-and-swap, the other side may be an interrupt
+	bool moved = false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (box->readPoint == read) {
+			box->readPoint = next;
+			moved = true;
+		}
+	}
+
+	return moved;
+#else
+	return __atomic_compare_exchange_n(&box->readPoint, &read, next, false,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+/**
+ * @brief oldest message of one lane, NULL if it is empty.
+ */
+static const Message_t* peekLane(MessageBox_t *box, uint8_t *point) {
+	// consumer side: only readPoint is stored here, unless overwritten
+	uint8_t read = __atomic_load_n(&box->readPoint, __ATOMIC_ACQUIRE);
+
+	*point = read;
+
+	if (read == __atomic_load_n(&box->writePoint, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &box->data[slot(box, read)];
+}
+
+
+/**
+ * @brief free the slot of the last peek, false if it was overwritten.
+ */
+static bool releasePeeked(MessageBox_t *box) {
+	uint8_t read = box->peekPoint;
+
+	// a higher lane may have filled up since the peek
+	if (box->peekLane) {
+		box = &box->lanes[box->peekLane - 1];
+	}
+
+	if (read == __atomic_load_n(&box->writePoint, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	if (box->overflow == kMessageOverflowOverwrite) {
+		return moveRead(box, read);
+	}
+
+	// the slot may be overwritten once readPoint moves on
+	__atomic_store_n(&box->readPoint, advance(box, read), __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
 MessageBox_t messagebox_create(Message_t *data, uint8_t num) {
-	assert(num);
+	assert(num && num <= 128);
 	assert(data);
 
 	MessageBox_t box;
@@ -22,9 +130,18 @@ MessageBox_t messagebox_create(Message_t *data, uint8_t num) {
 	box.data = data;
 
 	box.capacity = num;
+	box.mask = (num > 1 && (num & (num - 1)) == 0) ? num - 1 : 0;
 	box.readPoint = 0;
 	box.writePoint = 0;
-	box.isFull = false;
+	box.lanes = NULL;
+	box.classify = NULL;
+	box.laneCount = 0;
+	box.peekLane = 0;
+	box.peekPoint = 0;
+	box.overflow = kMessageOverflowDropNewest;
+	box.counters = (MessageBoxCounters_t){ 0, 0, 0 };
+	box.nakDue = false;
+	box.nakAddress = 0;
 
 	assert(messagebox_isEmpty(&box));
 
@@ -32,6 +149,76 @@ MessageBox_t messagebox_create(Message_t *data, uint8_t num) {
 }
 
 
+void messagebox_setLanes(MessageBox_t *box, 
+						MessageBox_t *lanes, 
+						uint8_t n, 
+						MessageClassify_t classify) 
+{
+	assert(box && (lanes || n == 0));
+
+	box->lanes = lanes;
+	box->classify = classify;
+	box->laneCount = n;
+	box->peekLane = 0;
+}
+
+
+MessageBox_t* messagebox_getLane(MessageBox_t *box, const Message_t *message) {
+	if (box->laneCount == 0) {
+		return box;
+	}
+
+	uint8_t lane = box->classify ? box->classify(message) 
+					: (message->flags & MESSAGE_PRIORITY_MASK) >> MESSAGE_PRIORITY_SHIFT;
+
+	if (lane == 0) {
+		return box;
+	}
+
+	return &box->lanes[((lane > box->laneCount) ? box->laneCount : lane) - 1];
+}
+
+
+void messagebox_setOverflow(MessageBox_t *box, MessageOverflow_t policy) {
+	assert(box);
+
+	box->overflow = policy;
+}
+
+
+void messagebox_getCounters(MessageBox_t *box, MessageBoxCounters_t *counters) {
+	assert(box && counters);
+
+	*counters = box->counters;
+
+	for (uint8_t i = 0; i < box->laneCount; i++) {
+		counters->dropped += box->lanes[i].counters.dropped;
+		counters->overwritten += box->lanes[i].counters.overwritten;
+		counters->rejected += box->lanes[i].counters.rejected;
+	}
+}
+
+
+bool messagebox_takeNak(MessageBox_t *box, uint8_t *address) {
+	assert(box && address);
+
+	for (uint8_t i = 0; i < box->laneCount; i++) {
+		if (messagebox_takeNak(&box->lanes[i], address)) {
+			return true;
+		}
+	}
+
+	if (!__atomic_load_n(&box->nakDue, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	*address = box->nakAddress;
+	__atomic_store_n(&box->nakDue, false, __ATOMIC_RELAXED);
+
+	return true;
+}
+
+
 void messagebox_clear(MessageBox_t *box) {
 	Message_t dump;
 
@@ -49,14 +236,19 @@ bool messagebox_isAvailable(MessageBox_t *box) {
 bool messagebox_isEmpty(MessageBox_t *box) {
 	assert(box);
 
-	return (!box->isFull && (box->readPoint == box->writePoint));
+	for (uint8_t i = 0; i < box->laneCount; i++) {
+		if (!messagebox_isEmpty(&box->lanes[i])) {
+			return false;
+		}
+	}
+
+	return __atomic_load_n(&box->readPoint, __ATOMIC_ACQUIRE)
+			== __atomic_load_n(&box->writePoint, __ATOMIC_ACQUIRE);
 }
 
 
 bool messagebox_isFull(MessageBox_t *box) {
-	assert(box);
-
-	return box->isFull;
+	return messagebox_getUsedSpace(box) == box->capacity;
 }
 
 
@@ -70,18 +262,8 @@ uint8_t messagebox_getCapacity(MessageBox_t *box) {
 uint8_t messagebox_getUsedSpace(MessageBox_t *box) {
 	assert(box);
 
-	uint8_t number = box->capacity;
-
-	if (!box->isFull) {
-		if (box->readPoint <= box->writePoint) {
-			number = box->writePoint - box->readPoint;
-		}
-		else {
-			number -= box->readPoint - box->writePoint;
-		}
-	}
-
-	return number;
+	return distance(box, __atomic_load_n(&box->readPoint, __ATOMIC_ACQUIRE),
+						__atomic_load_n(&box->writePoint, __ATOMIC_ACQUIRE));
 }
 
 
@@ -90,54 +272,86 @@ uint8_t messagebox_getFreeSpace(MessageBox_t *box) {
 }
 
 
-/*void increase_checkpoints(MessageBox_t* box) {
-	assert(box);
+int messagebox_push(MessageBox_t *box, const Message_t *data) {
+	assert(box && box->data);
 
-	if (box->isFull) {
-		box->readPoint = (box->readPoint + 1) % box->capacity;
+	box = messagebox_getLane(box, data);
+
+	// producer side: only writePoint is stored here
+	uint8_t write = box->writePoint;
+	uint8_t read = __atomic_load_n(&box->readPoint, __ATOMIC_ACQUIRE);
+
+	if (distance(box, read, write) == box->capacity) {
+		switch (box->overflow) {
+			case kMessageOverflowOverwrite:
+				// if the consumer takes it first, there is room anyway
+				if (moveRead(box, read)) {
+					box->counters.overwritten++;
+				}
+				break;
+
+			case kMessageOverflowReject:
+				box->counters.rejected++;
+				box->nakAddress = data->address;
+				__atomic_store_n(&box->nakDue, true, __ATOMIC_RELEASE);
+				return -1;
+
+			default:
+				box->counters.dropped++;
+				return -1;
+		}
 	}
 
-	box->writePoint = (box->writePoint + 1) % box->capacity;
-	box->isFull = (box->readPoint == box->writePoint);
+	box->data[slot(box, write)] = *data;
+
+	// publish the message after it is written
+	__atomic_store_n(&box->writePoint, advance(box, write), __ATOMIC_RELEASE);
+
+	return 0;
 }
 
 
-void decrease_checkpoints(MessageBox_t* box) {
-	assert(box);
+int messagebox_pop(MessageBox_t *box, Message_t *data) {
+	assert(box && box->data && data);
 
-	box->readPoint = (box->readPoint + 1) % box->capacity;
-	box->isFull = false;
-}*/
+	const Message_t *message;
 
+	// copied again if it was overwritten while being copied
+	do {
+		message = messagebox_peek(box);
 
-void messagebox_push(MessageBox_t *box, Message_t *data) {
-	assert(box && box->data);
+		if (message == NULL) {
+			return -1;
+		}
 
-	if (!box->isFull) {
-		box->data[box->writePoint] = *data;
+		*data = *message;
+	} while (!releasePeeked(box));
 
-		box->writePoint = (box->writePoint + 1) % box->capacity;
-		box->isFull = (box->readPoint == box->writePoint);
-	}
+	return 0;
 }
 
 
-int messagebox_pop(MessageBox_t *box, Message_t *data) {
-	assert(box && box->data && data);
+const Message_t* messagebox_peek(MessageBox_t *box) {
+	assert(box && box->data);
+
+	// highest class first
+	for (uint8_t i = box->laneCount; i > 0; i--) {
+		const Message_t *message = peekLane(&box->lanes[i - 1], &box->peekPoint);
 
-	int ret = -1;
+		if (message) {
+			box->peekLane = i;
+			return message;
+		}
+	}
 
-	if (!messagebox_isEmpty(box)) {
-		*data = box->data[box->readPoint];
+	box->peekLane = 0;
 
-		/**
-		 * update checkpoints after getting data into box
-		 */
-		box->readPoint = (box->readPoint + 1) % box->capacity;
-		box->isFull = false;
+	return peekLane(box, &box->peekPoint);
+}
 
-		ret = 0;
-	}
 
-	return ret;
-}
\ No newline at end of file
+void messagebox_release(MessageBox_t *box) {
+	assert(box && box->data);
+
+	releasePeeked(box);
+}
@@ -4,10 +4,10 @@
  *  
  * This library is used to create Data Link Layer for existed Physical Layers,
  * such as UART, SPI, I2C,...
- *
+ *  
  * @author Nguyen Trong Phuong (aka trongphuongpro)
  * @date 2019 Dec 28
- */
+ */  
 
 #include "message.h"
 
@@ -15,252 +15,396 @@
 #include <string.h>
 
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
-#include "messagebox.h"
+#include "message_link.h"
 #include "uart.h"
-#include "crc32.h"
-
-
-typedef enum step {	kParsingPreamble = 0,
-					kParsingAddress,
-					kParsingSize,
-					kParsingPayload,
-					kParsingChecksum,
-					kVerifyingChecksum
-} step_t;
 
 
 /** 
- * @brief Struct contains message frame
+ * @brief Struct contains the state of one link
  */  
-typedef struct MessageFrame {
-	uint8_t preamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief preamble of message frame */
-	uint8_t address[2]; /**< @brief destination and source address: 2 bytes*/
-	uint8_t payloadSize; /**< @brief size of payload: 1 byte */
-	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE]; /**< @brief payload */
-	crc32_t checksum; /**< @brief CRC-32 checksum: 4 bytes */
-} __attribute__((packed)) MessageFrame_t;
-
-
-typedef void (*callbacktype)(void);
-
-static volatile step_t currentStep = kParsingPreamble;
-static uint8_t validPreamble[MESSAGE_PREAMBLE_SIZE] = {0xAA, 0xBB, 0xCC, 0xDD};
-static MessageFrame_t rxFrame;
-static MessageFrame_t txFrame;
-static MessageBox_t messageBox;
-
-static void createFrame(const void*, uint8_t, uint8_t, const void*, uint8_t);
-static void parsePreamble(void);
-static void parseAddress(void);
-static void parseSize(void);
-static void parsePayload(void);
-static void parseChecksum(void);
-static int verifyChecksum(void);
-static Message_t extractMessage(MessageFrame_t *);
-
-static callbacktype callback[] = {	parsePreamble, 
-									parseAddress, 
-									parseSize, 
-									parsePayload, 
-									parseChecksum };
+typedef struct MessagePort {
+	MessageLink_t link; /**< @brief protocol state, first so it is also the handle */
+	uint32_t baudrate; /**< @brief UART baudrate */
+	volatile bool txBusy; /**< @brief txFrame belongs to the UDRE interrupt */
+	uint16_t txLength; /**< @brief size of txFrame in byte */
+	uint16_t txIndex; /**< @brief next byte of txFrame to send */
+	MessageSendCallback_t txDone; /**< @brief end of message_sendAsync() */
+#if MESSAGE_RX_TIMEOUT && MESSAGE_TIMER2
+	uint8_t rxTimerClock; /**< @brief Timer2 clock select, CS22..CS20 */
+	uint8_t rxTimerRepeat; /**< @brief compare matches per timeout */
+	uint8_t rxTimerCount; /**< @brief compare matches left */
+#elif MESSAGE_RX_TIMEOUT
+	uint16_t rxTimeoutTicks; /**< @brief message_tick() periods per timeout */
+	uint16_t rxTimer; /**< @brief message_tick() periods left, 0 when stopped */
+#endif
+} MessagePort_t;
+
+
+// only USART0 is driven, so there is a single port
+static MessagePort_t port0;
+
+static void writeLine(void*, const void*, uint32_t);
+static void writeAddress(void*, uint8_t);
+static void waitIdle(void*);
+static void frameGap(void*);
+static void lineFormat(void*);
+static void addressFilter(bool);
+static void receive(MessagePort_t*);
+#if MESSAGE_RX_TIMEOUT
+static void timerInit(MessagePort_t*);
+static void lineIdle(MessagePort_t*);
+#endif
+
+
+static const MessageLinkOps_t linkOps = { .write = writeLine,
+										.writeAddress = writeAddress,
+										.waitIdle = waitIdle,
+										.frameGap = frameGap,
+										.lineFormat = lineFormat };
 
 
 MessageBoxHandle_t uart_messagebox_create(uint32_t baudrate, 
 									Message_t *data,
 									uint8_t num) 
 {
-	
+	MessagePort_t *port = uart_messageport_create(baudrate, data, num);
+
+	return &port->link.messageBox;
+}
+
+
+MessagePortHandle_t uart_messageport_create(uint32_t baudrate, 
+									Message_t *data,
+									uint8_t num) 
+{
+	MessagePort_t *port = &port0;
+
+	// no RX interrupt while the port is set up again
+	UCSR0B &= ~((1 << RXCIE0) | (1 << UDRIE0) | (1 << TXCIE0));
+#if MESSAGE_RX_TIMEOUT && MESSAGE_TIMER2
+	TCCR2B = 0;
+#endif
+
+	port->baudrate = baudrate;
+	port->txBusy = false;
+	message_link_init(&port->link, data, num, &linkOps);
+	// the only port is always the default one
+	message_link_setDefault(&port->link);
+
+#if MESSAGE_ISR_HISTOGRAM && MESSAGE_TIMER1
+	// Timer1 runs free at F_CPU, the RX interrupt takes its time from it
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+#endif
+
 	atmega_uart_init(baudrate);
+	lineFormat(port);
+#if MESSAGE_RX_TIMEOUT
+	timerInit(port);
+#endif
 	sei();
 
-	messageBox = messagebox_create(data, num);
-
-	return &messageBox;
+	return port;
 }
 
 
-void message_setPreamble(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4) {
-	validPreamble[0] = b1;
-	validPreamble[1] = b2;
-	validPreamble[2] = b3;
-	validPreamble[3] = b4;
+uint32_t message_poll(void) {
+	return messageport_poll(&port0);
 }
 
 
-void message_send(	const void* _preamble, 
+int messageport_sendAsync(MessagePortHandle_t _port,
+						const void* _preamble, 
 						uint8_t des, 
 						uint8_t src, 
 						const void* _data, 
-						uint8_t len) {
+						messagesize_t len,
+						MessageSendCallback_t done) {
 
-	createFrame(_preamble, des, src, _data, len);
+	MessagePort_t *port = _port;
 
-	uart_sendBuffer(txFrame.preamble, 4);
-	uart_sendBuffer(txFrame.address, 2);
-	uart_send(txFrame.payloadSize);
-	uart_sendBuffer(txFrame.payload, txFrame.payloadSize);
-	uart_sendBuffer(&txFrame.checksum, sizeof(crc32_t));
+	if (port->txBusy) {
+		return -1;
+	}
 
-	_delay_ms(5);
-}
+	port->txLength = message_link_createFrame(&port->link, _preamble, des, src,
+											_data, len);
+	port->txIndex = 0;
 
+	if (port->txLength == 0) {
+		return -1;
+	}
 
-int verifyChecksum() {
-	crc32_t ret = crc32_concat(crc32_compute(&rxFrame, 
-											sizeof(rxFrame.preamble) 
-											+ sizeof(rxFrame.address) 
-											+ sizeof(rxFrame.payloadSize)),
-								rxFrame.payload, rxFrame.payloadSize);
+	port->txDone = done;
+#if MESSAGE_STATS
+	port->link.stats.txFrames++;
+#endif
+	port->txBusy = true;
 
-	if (ret == rxFrame.checksum) {
-		return 0;
-	}
-	else {
-		return -1;
+	if (port->link.parser.framing == kMessageFramingAddress) {
+		// the UDRE interrupt clears the 9th bit behind the address
+		port->txIndex = MESSAGE_PREAMBLE_SIZE;
+		UCSR0B |= (1 << TXB80);
 	}
+
+	// UDRE fires right away if the data register is empty
+	UCSR0B |= (1 << UDRIE0);
+
+	return 0;
 }
 
 
-void createFrame(const void* __preamble, 
-					uint8_t des, 
-					uint8_t src, 
-					const void* _data, 
-					uint8_t len) {
+bool messageport_isSending(MessagePortHandle_t port) {
+	return ((MessagePort_t*)port)->txBusy;
+}
 
-	uint8_t* preamble = (uint8_t*)__preamble;
-	uint8_t* data = (uint8_t*)_data;
 
-	// PREAMBLE
-	for (uint8_t i = 0; i < MESSAGE_PREAMBLE_SIZE; i++) {
-		txFrame.preamble[i] = preamble[i];
+#if MESSAGE_STATS
+void messageport_getStats(MessagePortHandle_t _port, MessageStats_t *stats) {
+	MessagePort_t *port = _port;
+
+	// 16- and 32-bit counters, the RX interrupt must not tear them
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		message_link_getStats(&port->link, stats);
 	}
+}
+#endif
 
-	// ADDRESS
-	txFrame.address[0] = des;
-	txFrame.address[1] = src;
 
-	// PAYLOAD SIZE
-	txFrame.payloadSize = (len > MESSAGE_MAX_PAYLOAD_SIZE) ? 
-							MESSAGE_MAX_PAYLOAD_SIZE : len;
+void writeLine(void *port, const void *data, uint32_t len) {
+	(void)port;
 
-	// PAYLOAD
-    memcpy(txFrame.payload, data, txFrame.payloadSize);
-	
+	uart_sendBuffer(data, len);
+}
 
-	// CHECKSUM CRC32
-	crc32_t checksum = crc32_concat(crc32_compute(&txFrame, 
-											sizeof(txFrame.preamble) 
-											+ sizeof(txFrame.address) 
-											+ sizeof(txFrame.payloadSize)),
-								txFrame.payload, txFrame.payloadSize);
 
-	txFrame.checksum = checksum;
+void waitIdle(void *port) {
+	while (((MessagePort_t*)port)->txBusy) {
+		// the line still belongs to the UDRE interrupt
+	}
 }
 
 
-Message_t extractMessage(MessageFrame_t *frame) {
-	Message_t message;
+void frameGap(void *_port) {
+	MessagePort_t *port = _port;
 
-	message.address = frame->address[1];
-	message.payloadSize = frame->payloadSize;
+	// the last 2 bytes may still be in UDR0 and the shift register,
+	// a character is 10 bits
+	uint32_t us = 10UL * 1000000UL * (MESSAGE_FRAME_GAP + 2) / port->baudrate;
 
-	memcpy(message.payload, frame->payload, message.payloadSize);
-
-	return message;
+	while (us >= 10) {
+		_delay_us(10);
+		us -= 10;
+	}
 }
 
 
-void parsePreamble() {
-	if (currentStep == kParsingPreamble) {
-		static int counter;
 
-		rxFrame.preamble[counter] = UDR0;
+#if MESSAGE_RX_TIMEOUT && MESSAGE_TIMER2
+void timerInit(MessagePort_t *port) {
+	static const uint16_t prescaler[] = { 1, 8, 32, 64, 128, 256, 1024 };
 
-		if (rxFrame.preamble[counter] == validPreamble[counter]) {
-			counter++;
-		}
-		else {
-			counter = 0;
-		}
+	// a character is 10 bits
+	uint32_t cycles = F_CPU / port->baudrate * 10 * MESSAGE_RX_TIMEOUT;
+	uint8_t clock = 1;
 
-		// go to next currentStep if 4-byte preamble is read.
-		if (counter == MESSAGE_PREAMBLE_SIZE) {
-			counter = 0;
-			currentStep = kParsingAddress;
-		}
+	while (clock < 7 && cycles / prescaler[clock - 1] > 256) {
+		clock++;
 	}
+
+	uint32_t ticks = cycles / prescaler[clock - 1];
+
+	// slow lines need more than one round of the 8-bit counter
+	port->rxTimerRepeat = ticks / 256 + 1;
+	port->rxTimerClock = clock;
+
+	// CTC mode, stopped until the first byte arrives
+	TCCR2B = 0;
+	TCCR2A = (1 << WGM21);
+	OCR2A = ticks / port->rxTimerRepeat - 1;
+	TIMSK2 = (1 << OCIE2A);
+}
+#elif MESSAGE_RX_TIMEOUT
+void timerInit(MessagePort_t *port) {
+	// a character is 10 bits, one more period for the one already begun
+	port->rxTimeoutTicks = (10UL * MESSAGE_RX_TIMEOUT * MESSAGE_TICK_RATE
+							+ port->baudrate - 1) / port->baudrate + 1;
+	port->rxTimer = 0;
 }
+#endif
 
 
-void parseAddress() {
-	if (currentStep == kParsingAddress) {
-		static int counter;
+#if MESSAGE_RX_TIMEOUT
+void lineIdle(MessagePort_t *port) {
+	message_link_resync(&port->link);
 
-		rxFrame.address[counter++] = UDR0;
+	if (port->link.parser.framing == kMessageFramingAddress) {
+		addressFilter(true);
+	}
+}
+#endif
 
-		// go to next currentStep if 2-byte address is read.
-		if (counter == 2) {
-			counter = 0;
-			currentStep = kParsingSize;
-		}
+
+void lineFormat(void *_port) {
+	MessagePort_t *port = _port;
+
+	if (port->link.parser.framing == kMessageFramingAddress) {
+		// 9 data bits, idle until an address character arrives
+		UCSR0B |= (1 << UCSZ02);
+		addressFilter(true);
+	}
+	else {
+		UCSR0B &= ~((1 << UCSZ02) | (1 << TXB80));
+		addressFilter(false);
 	}
 }
 
 
-void parseSize() {
-	if (currentStep == kParsingSize) {
-		rxFrame.payloadSize = UDR0;
+void addressFilter(bool on) {
+	// TXC0 is cleared by writing a one, the error flags must be written 0
+	UCSR0A = (UCSR0A & (1 << U2X0)) | (on ? (1 << MPCM0) : 0);
+}
 
-		if (rxFrame.payloadSize > MESSAGE_MAX_PAYLOAD_SIZE) {
-			rxFrame.payloadSize = MESSAGE_MAX_PAYLOAD_SIZE;
-		}
 
-		currentStep = kParsingPayload;
+void writeAddress(void *port, uint8_t address) {
+	(void)port;
+
+	while (!(UCSR0A & (1 << UDRE0))) {
+		// wait
 	}
+
+	UCSR0B |= (1 << TXB80);
+	UDR0 = address;
+
+	// the 9th bit is taken once the character moves on to the shift
+	// register
+	while (!(UCSR0A & (1 << UDRE0))) {
+		// wait
+	}
+
+	UCSR0B &= ~(1 << TXB80);
 }
 
 
-void parsePayload() {
-	if (currentStep == kParsingPayload) {
-		static int counter;
+ISR(USART_UDRE_vect) {
+	MessagePort_t *port = &port0;
 
-		rxFrame.payload[counter++] = UDR0;
+	// the address character has left UDR0 with its 9th bit
+	if (port->txIndex == MESSAGE_PREAMBLE_SIZE + 1) {
+		UCSR0B &= ~(1 << TXB80);
+	}
 
-		if (counter == rxFrame.payloadSize) {
-			counter = 0;
-			currentStep = kParsingChecksum;
-		}
+	UDR0 = ((uint8_t*)&port->link.txFrame)[port->txIndex++];
+
+	if (port->txIndex == port->txLength) {
+		// last byte is queued, wait for it to leave the shift register
+		UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+		UCSR0B = (UCSR0B & ~(1 << UDRIE0)) | (1 << TXCIE0);
 	}
 }
 
 
-void parseChecksum() {
-	if (currentStep == kParsingChecksum) {
-		static int counter;
+ISR(USART_TX_vect) {
+	UCSR0B &= ~(1 << TXCIE0);
+	port0.txBusy = false;
+
+	if (port0.txDone) {
+		port0.txDone(&port0);
+	}
+}
 
-		((uint8_t*)&rxFrame.checksum)[counter++] = UDR0;
 
-		if (counter == sizeof(crc32_t)) {
-			counter = 0;
-			currentStep = kVerifyingChecksum;
+ISR(USART_RX_vect) {
+#if MESSAGE_ISR_HISTOGRAM
+	uint16_t start = TCNT1;
+
+	receive(&port0);
+	message_link_isrTime(&port0.link, (uint16_t)(TCNT1 - start));
+#else
+	receive(&port0);
+#endif
+}
 
-			if (verifyChecksum() == 0) {
-				if (!messagebox_isFull(&messageBox)) {
-                    Message_t new_message = extractMessage(&rxFrame);
-					messagebox_push(&messageBox, &new_message);
-				}
-			}
 
-			currentStep = kParsingPreamble;
+void receive(MessagePort_t *port) {
+	// the 9th bit is only valid until UDR0 is read
+	bool mark = UCSR0B & (1 << RXB80);
+
+#if MESSAGE_STATS
+	// a byte was lost in front of this one, also only valid until then
+	if (UCSR0A & (1 << DOR0)) {
+		port->link.stats.overruns++;
+	}
+#endif
+
+	uint8_t byte = UDR0;
+
+#if MESSAGE_RX_TIMEOUT && MESSAGE_TIMER2
+	// every byte restarts the idle timer
+	TCNT2 = 0;
+	TIFR2 = (1 << OCF2A);
+	port->rxTimerCount = port->rxTimerRepeat;
+	TCCR2B = port->rxTimerClock;
+#elif MESSAGE_RX_TIMEOUT
+	port->rxTimer = port->rxTimeoutTicks;
+#endif
+
+	if (port->link.parser.framing == kMessageFramingAddress && mark) {
+		// a new frame, whatever is left of the last one is dropped
+		message_link_resync(&port->link);
+
+		// with MPCM0 set only address characters get here
+		if (!message_parser_accepts(&port->link.parser, byte)) {
+#if MESSAGE_STATS
+			port->link.parser.filtered++;
+#endif
+			addressFilter(true);
+			return;
 		}
+
+		addressFilter(false);
+	}
+
+	message_link_receive(&port->link, &byte, 1);
+
+#if !MESSAGE_DEFERRED
+	if (port->link.parser.framing == kMessageFramingAddress
+		&& message_parser_isIdle(&port->link.parser))
+	{
+		// frame done, data characters are ignored again
+		addressFilter(true);
 	}
+#endif
 }
 
 
-ISR(USART_RX_vect) {
-	if (currentStep < kVerifyingChecksum) {
-		callback[currentStep]();
+#if MESSAGE_RX_TIMEOUT && MESSAGE_TIMER2
+ISR(TIMER2_COMPA_vect) {
+	if (--port0.rxTimerCount == 0) {
+		// no byte for MESSAGE_RX_TIMEOUT characters
+		TCCR2B = 0;
+		lineIdle(&port0);
 	}
-}
\ No newline at end of file
+}
+#elif MESSAGE_RX_TIMEOUT
+void message_tick(void) {
+	MessagePort_t *port = &port0;
+
+	// the RX interrupt reloads the timer, called from the main loop the
+	// tick must not run in between
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (port->rxTimer && --port->rxTimer == 0) {
+			if (UCSR0A & (1 << RXC0)) {
+				// a byte still waits for the RX interrupt, not idle
+				port->rxTimer = port->rxTimeoutTicks;
+			}
+			else {
+				lineIdle(port);
+			}
+		}
+	}
+}
+#endif
@@ -0,0 +1,459 @@
+/** 
+ * @file uart_message_host.c
+ * @brief Implementations for message protocol on POSIX hosts
+ *  
+ * The UART is a file descriptor (tty, pty pair or socketpair). A receiver
+ * thread sleeps in epoll_wait() and plays the role of the RX interrupt
+ * for every open port.
+ */  
+
+#include "message.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "message_link.h"
+#include "uart.h"
+
+
+/** 
+ * @brief baudrate assumed for timing when the tty speed is not a standard one
+ */  
+#define FALLBACK_BAUDRATE   9600
+
+
+/** 
+ * @brief Struct contains the state of one link
+ */  
+typedef struct MessagePort {
+    MessageLink_t link; /**< @brief protocol state, first so it is also the handle */
+    int fd; /**< @brief file descriptor of the link */
+    uint32_t epoch; /**< @brief opens so far, older epoll events are stale */
+    uint32_t baudrate; /**< @brief speed of the tty, times its frame gap and line timeout */
+    bool isTTY; /**< @brief fd is a real serial line */
+    bool txBusy; /**< @brief txFrame belongs to the receiver thread */
+    uint16_t txLength; /**< @brief size of txFrame in byte */
+    uint16_t txIndex; /**< @brief next byte of txFrame to send */
+    MessageSendCallback_t txDone; /**< @brief end of message_sendAsync() */
+#if MESSAGE_RX_TIMEOUT
+    uint64_t rxDeadline; /**< @brief CLOCK_MONOTONIC ns of the line timeout, 0: off */
+#endif
+} MessagePort_t;
+
+
+static MessagePort_t ports[MESSAGE_MAX_PORTS];
+static uint8_t portCount;
+static pthread_t rxThread;
+static int epollfd = -1;
+// held by the receiver thread while it handles events, and while a port
+// is (re)opened
+static pthread_mutex_t portLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void writeLine(void*, const void*, uint32_t);
+static void waitIdle(void*);
+static void frameGap(void*);
+static uint64_t eventTag(MessagePort_t*);
+static void watchOutput(MessagePort_t*, bool);
+static void transmit(MessagePort_t*);
+static void receive(MessagePort_t*);
+static void* ISR(void*);
+#if MESSAGE_RX_TIMEOUT || MESSAGE_ISR_HISTOGRAM
+static uint64_t now(void);
+#endif
+#if MESSAGE_RX_TIMEOUT
+static int waitTime(void);
+static void checkIdle(void);
+#endif
+
+
+
+static const MessageLinkOps_t linkOps = { .write = writeLine,
+                                          .waitIdle = waitIdle,
+                                          .frameGap = frameGap };
+
+
+MessageBoxHandle_t uart_messagebox_create(uint32_t fd,
+                                    Message_t *data,
+                                    uint8_t num) 
+{
+    MessagePort_t *port = uart_messageport_create(fd, data, num);
+
+    if (port == NULL) {
+        return NULL;
+    }
+
+    // uart_print() and friends keep talking to the default link
+    host_uart_init(port->fd, 0);
+    message_link_setDefault(&port->link);
+
+    return &port->link.messageBox;
+}
+
+
+MessagePortHandle_t uart_messageport_create(uint32_t fd,
+                                    Message_t *data,
+                                    uint8_t num) 
+{
+    MessagePort_t *port = NULL;
+
+    if (epollfd < 0) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd < 0) {
+            return NULL;
+        }
+
+        if (pthread_create(&rxThread, NULL, ISR, NULL) != 0) {
+            close(epollfd);
+            epollfd = -1;
+            return NULL;
+        }
+
+        pthread_detach(rxThread);
+    }
+
+    // the receiver thread is off all ports until the end
+    pthread_mutex_lock(&portLock);
+
+    for (uint8_t i = 0; i < portCount; i++) {
+        if (ports[i].fd == (int)fd) {
+            port = &ports[i];
+        }
+    }
+
+    if (port == NULL) {
+        if (portCount == MESSAGE_MAX_PORTS) {
+            pthread_mutex_unlock(&portLock);
+            return NULL;
+        }
+
+        // the slot is only taken once the port is watched
+        port = &ports[portCount];
+    }
+    else {
+        // opened again, events already returned carry the old epoch
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, port->fd, NULL);
+    }
+
+    port->fd = (int)fd;
+    port->epoch++;
+    port->isTTY = isatty(port->fd);
+    port->txBusy = false;
+#if MESSAGE_RX_TIMEOUT
+    port->rxDeadline = 0;
+#endif
+    // no 9th bit on the host, the address goes out as a plain byte
+    message_link_init(&port->link, data, num, &linkOps);
+
+    // the tty keeps the speed it was set up with
+    port->baudrate = host_uart_open(port->fd, 0);
+    if (port->baudrate == 0) {
+        port->baudrate = FALLBACK_BAUDRATE;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP,
+                                 .data.u64 = eventTag(port) };
+
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, port->fd, &event) < 0) {
+        pthread_mutex_unlock(&portLock);
+        return NULL;
+    }
+
+    if (port == &ports[portCount]) {
+        portCount++;
+    }
+
+    pthread_mutex_unlock(&portLock);
+
+    return port;
+}
+
+
+uint32_t message_poll(void) {
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < portCount; i++) {
+        total += messageport_poll(&ports[i]);
+    }
+
+    return total;
+}
+
+
+int messageport_sendAsync(MessagePortHandle_t _port,
+                        const void* _preamble, 
+                        uint8_t des, 
+                        uint8_t src, 
+                        const void* _data, 
+                        messagesize_t len,
+                        MessageSendCallback_t done) 
+{
+    MessagePort_t *port = _port;
+
+    if (messageport_isSending(port)) {
+        return -1;
+    }
+
+    port->txLength = message_link_createFrame(&port->link, _preamble, des, src,
+                                            _data, len);
+    // a 9-bit frame starts behind the unused preamble
+    port->txIndex = (port->link.parser.framing == kMessageFramingAddress) ?
+                    MESSAGE_PREAMBLE_SIZE : 0;
+
+    if (port->txLength == 0) {
+        return -1;
+    }
+
+    port->txDone = done;
+#if MESSAGE_STATS
+    port->link.stats.txFrames++;
+#endif
+    __atomic_store_n(&port->txBusy, true, __ATOMIC_RELEASE);
+
+    // the receiver thread writes the frame whenever the fd takes more
+    watchOutput(port, true);
+
+    return 0;
+}
+
+
+bool messageport_isSending(MessagePortHandle_t port) {
+    return __atomic_load_n(&((MessagePort_t*)port)->txBusy, __ATOMIC_ACQUIRE);
+}
+
+
+#if MESSAGE_STATS
+void messageport_getStats(MessagePortHandle_t _port, MessageStats_t *stats) {
+    MessagePort_t *port = _port;
+
+    // the receiver thread keeps counting meanwhile
+    message_link_getStats(&port->link, stats);
+}
+#endif
+
+
+void writeLine(void *port, const void *data, uint32_t len) {
+    host_uart_sendBuffer(((MessagePort_t*)port)->fd, data, len);
+}
+
+
+void waitIdle(void *port) {
+    while (messageport_isSending(port)) {
+        // the line still belongs to the receiver thread
+        sched_yield();
+    }
+}
+
+
+void frameGap(void *_port) {
+    MessagePort_t *port = _port;
+
+    // a real serial line: idle it for the frame gap, a character is 10 bits
+    if (port->isTTY) {
+        tcdrain(port->fd);
+        nanosleep(&(struct timespec){ 
+                    .tv_nsec = 10000000000LL * MESSAGE_FRAME_GAP / port->baudrate 
+                }, NULL);
+    }
+}
+
+
+/** 
+ * @brief epoll data of a port: its index and the epoch it was opened in
+ */  
+uint64_t eventTag(MessagePort_t *port) {
+    return ((uint64_t)port->epoch << 8) | (uint64_t)(port - ports);
+}
+
+
+void watchOutput(MessagePort_t *port, bool enable) {
+    struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP,
+                                 .data.u64 = eventTag(port) };
+
+    if (enable) {
+        event.events |= EPOLLOUT;
+    }
+
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, port->fd, &event);
+}
+
+
+void transmit(MessagePort_t *port) {
+    while (port->txIndex < port->txLength) {
+        ssize_t n = write(port->fd, (uint8_t*)&port->link.txFrame + port->txIndex, 
+                            port->txLength - port->txIndex);
+
+        if (n > 0) {
+            port->txIndex += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // resumed on the next EPOLLOUT
+            return;
+        }
+        else if (!(n < 0 && errno == EINTR)) {
+            // peer is gone, the frame is lost
+            break;
+        }
+    }
+
+    // the next frame may be queued as soon as txBusy drops
+    MessageSendCallback_t done = port->txDone;
+
+    watchOutput(port, false);
+    __atomic_store_n(&port->txBusy, false, __ATOMIC_RELEASE);
+
+    if (done) {
+        done(port);
+    }
+}
+
+
+void receive(MessagePort_t *port) {
+    uint8_t buffer[4096];
+    ssize_t n;
+
+    while ((n = read(port->fd, buffer, sizeof(buffer))) > 0) {
+        message_link_receive(&port->link, buffer, (uint32_t)n);
+
+#if MESSAGE_RX_TIMEOUT
+        // only a real serial line has character times to wait for
+        if (port->isTTY) {
+            port->rxDeadline = now() + 10000000000ULL * MESSAGE_RX_TIMEOUT 
+                                        / port->baudrate;
+        }
+#endif
+    }
+}
+
+
+void* ISR(void *arg) {
+    struct epoll_event events[MESSAGE_MAX_PORTS];
+
+    (void)arg;
+
+    for (;;) {
+#if MESSAGE_RX_TIMEOUT
+        pthread_mutex_lock(&portLock);
+        int timeout = waitTime();
+        pthread_mutex_unlock(&portLock);
+
+        int n = epoll_wait(epollfd, events, MESSAGE_MAX_PORTS, timeout);
+#else
+        int n = epoll_wait(epollfd, events, MESSAGE_MAX_PORTS, -1);
+#endif
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&portLock);
+
+        for (int i = 0; i < n; i++) {
+            MessagePort_t *port = &ports[events[i].data.u64 & 0xFF];
+
+            // the port has been opened again since epoll_wait() returned
+            if ((uint32_t)(events[i].data.u64 >> 8) != port->epoch) {
+                continue;
+            }
+
+#if MESSAGE_ISR_HISTOGRAM
+            uint64_t start = now();
+#endif
+
+            receive(port);
+
+            if ((events[i].events & EPOLLOUT) && messageport_isSending(port)) {
+                transmit(port);
+            }
+
+#if MESSAGE_ISR_HISTOGRAM
+            message_link_isrTime(&port->link, now() - start);
+#endif
+
+            // peer closed the link and everything has been parsed
+            if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, port->fd, NULL);
+            }
+        }
+
+#if MESSAGE_RX_TIMEOUT
+        checkIdle();
+#endif
+
+        pthread_mutex_unlock(&portLock);
+    }
+
+    return NULL;
+}
+
+
+#if MESSAGE_RX_TIMEOUT || MESSAGE_ISR_HISTOGRAM
+uint64_t now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+
+#if MESSAGE_RX_TIMEOUT
+/** 
+ * @brief epoll_wait() timeout up to the next line timeout, in ms.
+ */  
+int waitTime(void) {
+    uint64_t next = 0;
+
+    for (uint8_t i = 0; i < MESSAGE_MAX_PORTS; i++) {
+        if (ports[i].rxDeadline && (next == 0 || ports[i].rxDeadline < next)) {
+            next = ports[i].rxDeadline;
+        }
+    }
+
+    if (next == 0) {
+        return -1;
+    }
+
+    uint64_t t = now();
+
+    // rounded up, waking up early would only mean another round
+    return (next > t) ? (int)((next - t + 999999) / 1000000) : 0;
+}
+
+
+/** 
+ * @brief Drop the frames of the ports whose line stayed idle too long.
+ */  
+void checkIdle(void) {
+    uint64_t t = now();
+
+    for (uint8_t i = 0; i < MESSAGE_MAX_PORTS; i++) {
+        MessagePort_t *port = &ports[i];
+        int pending = 0;
+
+        if (port->rxDeadline == 0 || port->rxDeadline > t) {
+            continue;
+        }
+
+        // bytes not read yet arrived in time as far as we can tell
+        if (ioctl(port->fd, FIONREAD, &pending) == 0 && pending > 0) {
+            continue;
+        }
+
+        port->rxDeadline = 0;
+        message_link_resync(&port->link);
+    }
+}
+#endif
@@ -4,278 +4,514 @@
  *  
  * This library is used to create Data Link Layer for existed Physical Layers,
  * such as UART, SPI, I2C,...
- *
+ *  
  * @author Nguyen Trong Phuong (aka trongphuongpro)
  * @date 2019 Dec 28
- */
+ */  
 
 #include "message.h"
 
 #include <string.h>
 
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_uart.h"
+#include "driverlib/interrupt.h"
 #include "driverlib/uart.h"
 #include "driverlib/sysctl.h"
+#include "driverlib/udma.h"
+#include "driverlib/systick.h"
 
-#include "messagebox.h"
+#include "message_link.h"
 #include "uart.h"
-#include "crc32.h"
 
 
-typedef enum step { kParsingPreamble = 0,
-                    kParsingAddress,
-                    kParsingSize,
-                    kParsingPayload,
-                    kParsingChecksum,
-                    kVerifyingChecksum
-} step_t;
+/** 
+ * @brief number of UART modules on TM4C, UART0..UART7
+ */  
+#define UART_COUNT  8
 
 
 /** 
- * @brief Struct contains message frame
+ * @brief Cortex-M4 debug registers of the cycle counter, the clock of the
+ * frame gap and the ISR histogram
  */  
-typedef struct MessageFrame {
-    uint8_t preamble[MESSAGE_PREAMBLE_SIZE]; /**< @brief preamble of message frame */
-    uint8_t address[2]; /**< @brief destination and source address: 2 bytes*/
-    uint8_t payloadSize; /**< @brief size of payload: 1 byte */
-    uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE]; /**< @brief payload */
-    crc32_t checksum; /**< @brief CRC-32 checksum: 4 bytes */
-} __attribute__((packed)) MessageFrame_t;
+#define DEMCR               (*(volatile uint32_t*)0xE000EDFC)
+#define DEMCR_TRCENA        (1UL << 24)
+#define DWT_CTRL            (*(volatile uint32_t*)0xE0001000)
+#define DWT_CTRL_CYCCNTENA  (1UL << 0)
+#define DWT_CYCCNT          (*(volatile uint32_t*)0xE0001004)
+
 
+// one basic µDMA transfer moves at most 1024 items
+#if MESSAGE_MAX_PAYLOAD_SIZE + 12 > 1024
+#error "MESSAGE_MAX_PAYLOAD_SIZE too large for a single uDMA transfer"
+#endif
 
-typedef void (*callbacktype)(void);
 
+/** 
+ * @brief Struct contains the state of one link
+ */  
+typedef struct MessagePort {
+    MessageLink_t link; /**< @brief protocol state, first so it is also the handle */
+    uint32_t base; /**< @brief UART base address */
+    uint32_t baudrate; /**< @brief UART baudrate */
+    uint32_t txChannel; /**< @brief µDMA channel of UART TX */
+    bool txDMA; /**< @brief txChannel set up, by the first message_sendAsync() */
+    volatile bool txBusy; /**< @brief txFrame belongs to the µDMA */
+    volatile bool txGap; /**< @brief the frame gap of message_sendAsync() runs */
+    uint32_t txGapEnd; /**< @brief DWT_CYCCNT at the end of the gap */
+    uint32_t txGapCycles; /**< @brief length of the gap in core cycles */
+    MessageSendCallback_t txDone; /**< @brief end of message_sendAsync() */
+#if MESSAGE_RX_TIMEOUT
+    uint32_t interrupt; /**< @brief UART interrupt, pended by message_tick() */
+    uint16_t rxTimeoutTicks; /**< @brief message_tick() periods per timeout */
+    uint16_t rxTimer; /**< @brief message_tick() periods left, 0 when stopped */
+    volatile uint8_t rxBursts; /**< @brief FIFO bursts taken by the UART interrupt */
+    uint8_t rxBurstsSeen; /**< @brief rxBursts at the last message_tick() */
+    volatile bool rxIdle; /**< @brief timeout for the UART interrupt to apply */
+#endif
+} MessagePort_t;
+
+
+static MessagePort_t ports[MESSAGE_MAX_PORTS];
+static uint8_t portCount;
+static MessagePort_t *uartPorts[UART_COUNT];
+
+
+static void sendBuffer(MessagePort_t*, const void*, uint32_t);
+static uint32_t getTxChannel(uint32_t);
+static void dmaInit(MessagePort_t*);
+static void writeLine(void*, const void*, uint32_t);
+static void writeAddress(void*, uint8_t);
+static void waitIdle(void*);
+static void frameGap(void*);
+static void lineFormat(void*);
+static bool gapRunning(MessagePort_t*);
+#if MESSAGE_RX_TIMEOUT
+static void timerInit(MessagePort_t*);
+#endif
+static void ISR(MessagePort_t*);
+static void UART0ISR(void);
+static void UART1ISR(void);
+static void UART2ISR(void);
+static void UART3ISR(void);
+static void UART4ISR(void);
+static void UART5ISR(void);
+static void UART6ISR(void);
+static void UART7ISR(void);
+
+
+
+static void (* const uartISR[UART_COUNT])(void) = { UART0ISR, UART1ISR,
+                                                    UART2ISR, UART3ISR,
+                                                    UART4ISR, UART5ISR,
+                                                    UART6ISR, UART7ISR };
+
+#if MESSAGE_RX_TIMEOUT
+static const uint32_t uartInterrupt[UART_COUNT] = { INT_UART0, INT_UART1,
+                                                    INT_UART2, INT_UART3,
+                                                    INT_UART4, INT_UART5,
+                                                    INT_UART6, INT_UART7 };
+#endif
+
+
+static const MessageLinkOps_t linkOps = { .write = writeLine,
+                                          .writeAddress = writeAddress,
+                                          .waitIdle = waitIdle,
+                                          .frameGap = frameGap,
+                                          .lineFormat = lineFormat };
 
-static volatile step_t currentStep = kParsingPreamble;
-static uint8_t validPreamble[MESSAGE_PREAMBLE_SIZE] = {0xAA, 0xBB, 0xCC, 0xDD};
-static MessageFrame_t rxFrame;
-static MessageFrame_t txFrame;
-static MessageBox_t messageBox;
-static uint32_t UARTbase;
 
+MessageBoxHandle_t uart_messagebox_create(uint32_t uartbase,
+                                    uint32_t baudrate,
+                                    Message_t *data,
+                                    uint8_t num) 
+{
+    MessagePort_t *port = uart_messageport_create(uartbase, baudrate, data, num);
 
-static void createFrame(const void*, uint8_t, uint8_t, const void*, uint8_t);
-static void parsePreamble(void);
-static void parseAddress(void);
-static void parseSize(void);
-static void parsePayload(void);
-static void parseChecksum(void);
-static int verifyChecksum(void);
-static Message_t extractMessage(MessageFrame_t *);
-static void ISR(void);
+    if (port == NULL) {
+        return NULL;
+    }
 
+    message_link_setDefault(&port->link);
 
+    return &port->link.messageBox;
+}
 
-static callbacktype callback[] = {  parsePreamble, 
-                                    parseAddress, 
-                                    parseSize, 
-                                    parsePayload, 
-                                    parseChecksum };
-                                    
 
-MessageBoxHandle_t uart_messagebox_create(uint32_t uartbase,
+MessagePortHandle_t uart_messageport_create(uint32_t uartbase,
+                                    uint32_t baudrate,
                                     Message_t *data,
                                     uint8_t num) 
 {
-    UARTbase = uartbase;
+    // UART0..UART7 are 4 KiB apart
+    uint32_t number = (uartbase - UART0_BASE) >> 12;
+
+    if (uartbase < UART0_BASE || (uartbase & 0xFFF) || number >= UART_COUNT
+        || baudrate == 0)
+    {
+        return NULL;
+    }
 
-    UARTIntRegister(uartbase, ISR);
-    UARTIntEnable(uartbase, UART_INT_RX);
+    MessagePort_t *port = uartPorts[number];
 
-    tiva_uart_init(uartbase, 9600);
+    if (port == NULL) {
+        if (portCount == MESSAGE_MAX_PORTS) {
+            return NULL;
+        }
 
-    // Must not use FIFO
-    UARTFIFODisable(uartbase);
+        port = &ports[portCount++];
+    }
 
-    messageBox = messagebox_create(data, num);
+    UARTIntDisable(uartbase, UART_INT_RX | UART_INT_RT | UART_INT_TX);
 
-    return &messageBox;
-}
+    port->base = uartbase;
+    port->baudrate = baudrate;
+    port->txBusy = false;
+    port->txGap = false;
+    // a character is 10 bits
+    port->txGapCycles = SysCtlClockGet() / baudrate * 10 * MESSAGE_FRAME_GAP;
+    port->txDMA = false;
+    // the RX ring must be ready before the first RX interrupt
+    message_link_init(&port->link, data, num, &linkOps);
+
+    // the cycle counter runs free at the core clock
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
 
+#if MESSAGE_RX_TIMEOUT
+    port->interrupt = uartInterrupt[number];
+    timerInit(port);
+#endif
 
-void message_setPreamble(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4) {
-    validPreamble[0] = b1;
-    validPreamble[1] = b2;
-    validPreamble[2] = b3;
-    validPreamble[3] = b4;
+    uartPorts[number] = port;
+
+    UARTIntRegister(uartbase, uartISR[number]);
+    // RX fires at 8 of 16 bytes, RT when the line idles with bytes left
+    UARTIntEnable(uartbase, UART_INT_RX | UART_INT_RT);
+
+    tiva_uart_init(uartbase, port->baudrate);
+    lineFormat(port);
+
+    UARTFIFOLevelSet(uartbase, UART_FIFO_TX4_8, UART_FIFO_RX4_8);
+    UARTFIFOEnable(uartbase);
+
+    // µDMA is left alone until message_sendAsync() needs it, blocking
+    // sends work without it
+    UARTDMADisable(uartbase, UART_DMA_TX);
+
+    return port;
 }
 
 
-void message_send(  const void* _preamble, 
-                    uint8_t des, 
-                    uint8_t src, 
-                    const void* _data, 
-                    uint8_t len) 
-{
-    createFrame(_preamble, des, src, _data, len);
+uint32_t message_poll(void) {
+    uint32_t total = 0;
 
-    uart_sendBuffer(txFrame.preamble, 4);
-    uart_sendBuffer(txFrame.address, 2);
-    uart_send(txFrame.payloadSize);
-    uart_sendBuffer(txFrame.payload, txFrame.payloadSize);
-    uart_sendBuffer(&txFrame.checksum, sizeof(crc32_t));
+    for (uint8_t i = 0; i < portCount; i++) {
+        total += messageport_poll(&ports[i]);
+    }
 
-    // delay 3ms
-    SysCtlDelay(SysCtlClockGet() / 1000);
+    return total;
 }
 
 
+int messageport_sendAsync(MessagePortHandle_t _port,
+                        const void* _preamble,
+                        uint8_t des, 
+                        uint8_t src, 
+                        const void* _data, 
+                        messagesize_t len,
+                        MessageSendCallback_t done) 
+{
+    MessagePort_t *port = _port;
 
-int verifyChecksum() {
-    crc32_t ret = crc32_concat(crc32_compute(&rxFrame, 
-                                            sizeof(rxFrame.preamble) 
-                                            + sizeof(rxFrame.address) 
-                                            + sizeof(rxFrame.payloadSize)),
-                                rxFrame.payload, rxFrame.payloadSize);
+    if (port->txBusy || gapRunning(port)) {
+        return -1;
+    }
 
-    if (ret == rxFrame.checksum) {
-        return 0;
+    if (!port->txDMA) {
+        dmaInit(port);
     }
-    else {
+
+    uint16_t length = message_link_createFrame(&port->link, _preamble, des, src,
+                                            _data, len);
+    uint8_t *start = (uint8_t*)&port->link.txFrame;
+
+    if (length == 0) {
         return -1;
     }
-}
 
+    if (port->link.parser.framing == kMessageFramingAddress) {
+        // the 9th bit is the parity bit, the µDMA cannot switch it: the
+        // address character goes out by hand, blocking for one character,
+        // the µDMA sends the rest
+        UART9BitAddrSend(port->base, des);
+        start += MESSAGE_PREAMBLE_SIZE + 1;
+        length -= MESSAGE_PREAMBLE_SIZE + 1;
+    }
+
+    port->txDone = done;
+#if MESSAGE_STATS
+    port->link.stats.txFrames++;
+#endif
+    port->txBusy = true;
+
+    uDMAChannelTransferSet(port->txChannel | UDMA_PRI_SELECT, UDMA_MODE_BASIC,
+                            start, (void*)(port->base + UART_O_DR),
+                            length);
 
-Message_t extractMessage(MessageFrame_t *frame) {
-    Message_t message;
+    UARTIntClear(port->base, UART_INT_TX);
+    UARTIntEnable(port->base, UART_INT_TX);
+    uDMAChannelEnable(port->txChannel);
 
-    message.address = frame->address[1];
-    message.payloadSize = frame->payloadSize;
+    return 0;
+}
 
-    memcpy(message.payload, frame->payload, message.payloadSize);
 
-    return message;
+bool messageport_isSending(MessagePortHandle_t _port) {
+    MessagePort_t *port = _port;
+
+    return port->txBusy || gapRunning(port);
 }
 
 
-void createFrame(const void* _preamble, 
-                    uint8_t des, 
-                    uint8_t src, 
-                    const void* _data, 
-                    uint8_t len) 
-{
-    uint8_t* preamble = (uint8_t*)_preamble;
-    uint8_t* data = (uint8_t*)_data;
+#if MESSAGE_STATS
+void messageport_getStats(MessagePortHandle_t _port, MessageStats_t *stats) {
+    MessagePort_t *port = _port;
 
-    // PREAMBLE
-    for (uint8_t i = 0; i < MESSAGE_PREAMBLE_SIZE; i++) {
-        txFrame.preamble[i] = preamble[i];
+    // aligned 32-bit loads, a counter is never torn
+    message_link_getStats(&port->link, stats);
+}
+#endif
+
+
+#if MESSAGE_RX_TIMEOUT
+void timerInit(MessagePort_t *port) {
+    // a character is 10 bits, one more period for the one already begun
+    port->rxTimeoutTicks = (10UL * MESSAGE_RX_TIMEOUT * MESSAGE_TICK_RATE 
+                            + port->baudrate - 1) / port->baudrate + 1;
+    port->rxTimer = 0;
+    port->rxBursts = 0;
+    port->rxBurstsSeen = 0;
+    port->rxIdle = false;
+
+#if MESSAGE_SYSTICK
+    // one tick for all ports
+    SysTickPeriodSet(SysCtlClockGet() / MESSAGE_TICK_RATE);
+    SysTickIntRegister(message_tick);
+    SysTickIntEnable();
+    SysTickEnable();
+#endif
+}
+#endif
+
+
+uint32_t getTxChannel(uint32_t base) {
+    switch (base) {
+        case UART1_BASE:    return UDMA_CH23_UART1TX;
+        case UART2_BASE:    return UDMA_CH13_UART2TX;
+        case UART3_BASE:    return UDMA_CH17_UART3TX;
+        case UART4_BASE:    return UDMA_CH19_UART4TX;
+        case UART5_BASE:    return UDMA_CH7_UART5TX;
+        case UART6_BASE:    return UDMA_CH11_UART6TX;
+        case UART7_BASE:    return UDMA_CH21_UART7TX;
+        default:            return UDMA_CH9_UART0TX;
     }
+}
 
-    // ADDRESS
-    txFrame.address[0] = des;
-    txFrame.address[1] = src;
 
-    // PAYLOAD SIZE
-    txFrame.payloadSize = (len > MESSAGE_MAX_PAYLOAD_SIZE) ? 
-                            MESSAGE_MAX_PAYLOAD_SIZE : len;
+void dmaInit(MessagePort_t *port) {
+    // µDMA feeds the TX FIFO, the EOT interrupt reports the idle line
+    port->txChannel = getTxChannel(port->base);
+    uDMAChannelAssign(port->txChannel);
+    uDMAChannelAttributeDisable(port->txChannel, UDMA_ATTR_ALL);
+    uDMAChannelControlSet(port->txChannel | UDMA_PRI_SELECT,
+                        UDMA_SIZE_8 | UDMA_SRC_INC_8 | UDMA_DST_INC_NONE 
+                        | UDMA_ARB_4);
+    UARTTxIntModeSet(port->base, UART_TXINT_MODE_EOT);
+    UARTDMAEnable(port->base, UART_DMA_TX);
+
+    port->txDMA = true;
+}
 
-    // PAYLOAD
-    memcpy(txFrame.payload, data, txFrame.payloadSize);
 
+void sendBuffer(MessagePort_t *port, const void* buffer, uint32_t len) {
+    const uint8_t *data = (uint8_t*)buffer;
 
-    // CHECKSUM CRC32
-    txFrame.checksum = crc32_concat(crc32_compute(&txFrame, 
-                                            sizeof(txFrame.preamble) 
-                                            + sizeof(txFrame.address) 
-                                            + sizeof(txFrame.payloadSize)),
-                                txFrame.payload, txFrame.payloadSize);
+    for (uint32_t i = 0; i < len; i++) {
+        UARTCharPut(port->base, data[i]);
+    }
 }
 
 
-void parsePreamble() {
-    if (currentStep == kParsingPreamble) {
-        static int counter;
+void writeLine(void *port, const void *data, uint32_t len) {
+    sendBuffer(port, data, len);
+}
 
-        rxFrame.preamble[counter] = (uint8_t)UARTCharGet(UARTbase);
 
-        if (rxFrame.preamble[counter] == validPreamble[counter]) {
-            counter++;
-        }
-        else {
-            counter = 0;
-        }
+void writeAddress(void *port, uint8_t address) {
+    // waits for the line to drain, then sends with the 9th bit set
+    UART9BitAddrSend(((MessagePort_t*)port)->base, address);
+}
 
-        // go to next currentStep if 4-byte preamble is read.
-        if (counter == MESSAGE_PREAMBLE_SIZE) {
-            counter = 0;
-            currentStep = kParsingAddress;
-        }
+
+void lineFormat(void *_port) {
+    MessagePort_t *port = _port;
+
+    if (port->link.parser.framing == kMessageFramingAddress) {
+        // one address and mask in hardware: keep the bits where the node
+        // address agrees with MESSAGE_BROADCAST, the parser drops the rest
+        uint8_t mask = port->link.parser.addressMask 
+                        & ~(port->link.parser.nodeAddress ^ MESSAGE_BROADCAST);
+
+        // the parity bit is the 9th bit, 0 for data characters
+        UARTParityModeSet(port->base, UART_CONFIG_PAR_ZERO);
+        UART9BitAddrSet(port->base, port->link.parser.nodeAddress, mask);
+        UART9BitEnable(port->base);
+    }
+    else {
+        UART9BitDisable(port->base);
+        UARTParityModeSet(port->base, UART_CONFIG_PAR_NONE);
     }
 }
 
 
-void parseAddress() {
-    if (currentStep == kParsingAddress) {
-        static int counter;
+void waitIdle(void *port) {
+    while (messageport_isSending(port)) {
+        // the line still belongs to the µDMA or its frame gap
+    }
+}
 
-        rxFrame.address[counter++] = (uint8_t)UARTCharGet(UARTbase);
 
-        // go to next currentStep if 2-byte address is read.
-        if (counter == 2) {
-            counter = 0;
-            currentStep = kParsingSize;
-        }
+/** 
+ * @brief Check the frame gap scheduled by the end of a µDMA transfer.
+ */  
+bool gapRunning(MessagePort_t *port) {
+    if (port->txGap && (int32_t)(DWT_CYCCNT - port->txGapEnd) >= 0) {
+        // cleared once over, the counter wraps after a minute or so
+        port->txGap = false;
     }
+
+    return port->txGap;
 }
 
 
-void parseSize() {
-    if (currentStep == kParsingSize) {
-        rxFrame.payloadSize = (uint8_t)UARTCharGet(UARTbase);
+void frameGap(void *_port) {
+    MessagePort_t *port = _port;
 
-        if (rxFrame.payloadSize > MESSAGE_MAX_PAYLOAD_SIZE) {
-            rxFrame.payloadSize = MESSAGE_MAX_PAYLOAD_SIZE;
-        }
-
-        currentStep = kParsingPayload;
+    while (UARTBusy(port->base)) {
+        // wait for the TX FIFO to drain
     }
+
+    // SysCtlDelay() takes 3 cycles per loop
+    SysCtlDelay(port->txGapCycles / 3);
 }
 
 
-void parsePayload() {
-    if (currentStep == kParsingPayload) {
-        static int counter;
+void ISR(MessagePort_t *port) {
+    uint32_t base = port->base;
+#if MESSAGE_ISR_HISTOGRAM
+    uint32_t start = DWT_CYCCNT;
+#endif
 
-        rxFrame.payload[counter++] = (uint8_t)UARTCharGet(UARTbase);
+    UARTIntClear(base, UARTIntStatus(base, true));
 
-        if (counter == rxFrame.payloadSize) {
-            counter = 0;
-            currentStep = kParsingChecksum;
+#if MESSAGE_STATS
+    // the RX FIFO was full and the line kept going
+    if (UARTRxErrorGet(base) & UART_RXERROR_OVERRUN) {
+        UARTRxErrorClear(base);
+        port->link.stats.overruns++;
+    }
+#endif
+
+    // µDMA is done and the last stop bit has left the shift register
+    if (port->txBusy && !uDMAChannelIsEnabled(port->txChannel)
+        && !UARTBusy(base))
+    {
+        UARTIntDisable(base, UART_INT_TX);
+        // the next frame waits for the gap, the interrupt does not
+        port->txGapEnd = DWT_CYCCNT + port->txGapCycles;
+        port->txGap = true;
+        port->txBusy = false;
+
+        if (port->txDone) {
+            port->txDone(port);
         }
     }
-}
 
+#if MESSAGE_RX_TIMEOUT
+    // pended by message_tick(), stale if a burst came in since it looked
+    if (port->rxIdle) {
+        port->rxIdle = false;
 
-void parseChecksum() {
-    if (currentStep == kParsingChecksum) {
-        static int counter;
+        if (port->rxBursts == port->rxBurstsSeen) {
+            message_link_resync(&port->link);
+        }
+    }
 
-        ((uint8_t*)&rxFrame.checksum)[counter++] = (uint8_t)UARTCharGet(UARTbase);
+    // counted before the FIFO is drained, a tick in between sees either
+    // the bytes or the count
+    if (UARTCharsAvail(base)) {
+        port->rxBursts++;
+    }
+#endif
 
-        if (counter == sizeof(crc32_t)) {
-            counter = 0;
-            currentStep = kVerifyingChecksum;
+    // drain the whole FIFO, one interrupt per burst instead of per byte;
+    // bytes keep coming in while the parser runs, so until it is empty
+    uint8_t buffer[16];
+    uint32_t n;
 
-            if (verifyChecksum() == 0) {
-                if (!messagebox_isFull(&messageBox)) {
-                    Message_t new_message = extractMessage(&rxFrame);
-                    messagebox_push(&messageBox, &new_message);
-                }
-            }
+    do {
+        n = 0;
 
-            currentStep = kParsingPreamble;
+        while (n < sizeof(buffer) && UARTCharsAvail(base)) {
+            buffer[n++] = (uint8_t)UARTCharGetNonBlocking(base);
         }
-    }
+
+        message_link_receive(&port->link, buffer, n);
+    } while (n == sizeof(buffer));
+
+#if MESSAGE_ISR_HISTOGRAM
+    message_link_isrTime(&port->link, DWT_CYCCNT - start);
+#endif
 }
 
 
-void ISR() {
-    UARTIntClear(UARTbase, UART_INT_RX);
+#if MESSAGE_RX_TIMEOUT
+void message_tick(void) {
+    for (uint8_t i = 0; i < portCount; i++) {
+        MessagePort_t *port = &ports[i];
+        uint8_t bursts = port->rxBursts;
 
-    while (UARTCharsAvail(UARTbase)) {
-        if (currentStep < kVerifyingChecksum) {
-            callback[currentStep]();
+        // the parser belongs to the UART interrupt, which may run at
+        // another priority: the tick only counts and leaves the timeout
+        // to it
+        if (bursts != port->rxBurstsSeen) {
+            // the period already begun counts as the first
+            port->rxBurstsSeen = bursts;
+            port->rxTimer = port->rxTimeoutTicks - 1;
+        }
+        else if (port->rxTimer && --port->rxTimer == 0) {
+            if (UARTCharsAvail(port->base)) {
+                // bytes still wait for the RX interrupt, not idle
+                port->rxTimer = port->rxTimeoutTicks;
+            }
+            else {
+                port->rxIdle = true;
+                IntPendSet(port->interrupt);
+            }
         }
     }
-}
\ No newline at end of file
+}
+#endif
+
+
+void UART0ISR() { ISR(uartPorts[0]); }
+void UART1ISR() { ISR(uartPorts[1]); }
+void UART2ISR() { ISR(uartPorts[2]); }
+void UART3ISR() { ISR(uartPorts[3]); }
+void UART4ISR() { ISR(uartPorts[4]); }
+void UART5ISR() { ISR(uartPorts[5]); }
+void UART6ISR() { ISR(uartPorts[6]); }
+void UART7ISR() { ISR(uartPorts[7]); }
@@ -0,0 +1,114 @@
+/**
+ * @file test.c
+ * @brief Implementation of the helpers shared by the host tests
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "message_parser.h"
+#include "crc32.h"
+
+
+const uint8_t testPreamble[MESSAGE_PREAMBLE_SIZE] = {0xAA, 0xBB, 0xCC, 0xDD};
+
+static uint32_t checks;
+static uint32_t failures;
+
+
+bool test_check(bool condition, const char *text, const char *file, int line) {
+	checks++;
+
+	if (!condition) {
+		failures++;
+		printf("%s:%d: check failed: %s\n", file, line, text);
+	}
+
+	return condition;
+}
+
+
+int test_result(void) {
+	printf("%u checks, %u failed\n", checks, failures);
+
+	return failures ? 1 : 0;
+}
+
+
+uint32_t test_ms(void) {
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+
+bool test_waitBox(MessageBox_t *box, uint8_t count, uint32_t timeout) {
+	uint32_t start = test_ms();
+
+	do {
+		message_poll();
+
+		if (messagebox_getUsedSpace(box) >= count) {
+			return true;
+		}
+
+		usleep(1000);
+	} while (test_ms() - start < timeout);
+
+	return false;
+}
+
+
+uint32_t test_frame(uint8_t *buffer,
+					uint8_t des,
+					uint8_t src,
+					uint8_t flags,
+					const void *data,
+					uint16_t len)
+{
+	uint8_t *p = buffer;
+	messagesize_t field = flags ? (len + 1) | MESSAGE_SIZE_FLAGS : len;
+
+	memcpy(p, testPreamble, MESSAGE_PREAMBLE_SIZE);
+	p += MESSAGE_PREAMBLE_SIZE;
+	*p++ = des;
+	*p++ = src;
+
+	// 1 or 2 bytes, little-endian
+	for (uint8_t i = 0; i < sizeof(messagesize_t); i++) {
+		*p++ = (uint8_t)(field >> (8 * i));
+	}
+
+	if (flags) {
+		*p++ = flags;
+	}
+
+	memcpy(p, data, len);
+	p += len;
+
+	crc32_t checksum = crc32_compute(buffer, p - buffer);
+
+	memcpy(p, &checksum, sizeof(crc32_t));
+
+	return p - buffer + sizeof(crc32_t);
+}
+
+
+void test_write(int fd, const void *data, uint32_t len) {
+	const uint8_t *p = data;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n <= 0) {
+			return;
+		}
+
+		p += n;
+		len -= n;
+	}
+}
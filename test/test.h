@@ -0,0 +1,89 @@
+/**
+ * @file test.h
+ * @brief Helpers shared by the host tests
+ *
+ * Each test is a plain executable run by ctest: it prints the checks that
+ * failed and exits with 1 if there was one.
+ */
+
+
+#ifndef __TEST__
+#define __TEST__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "message.h"
+#include "messagebox.h"
+
+
+/**
+ * @brief Record a failed check, the test goes on.
+ */
+#define CHECK(condition) \
+	test_check((condition), #condition, __FILE__, __LINE__)
+
+
+/**
+ * @brief preamble of every test frame
+ */
+extern const uint8_t testPreamble[MESSAGE_PREAMBLE_SIZE];
+
+
+/**
+ * @brief Count a check, print it if it failed.
+ * @return the condition.
+ */
+bool test_check(bool condition, const char *text, const char *file, int line);
+
+
+/**
+ * @brief Exit code of the test.
+ * @return 0: all checks passed, 1: otherwise.
+ */
+int test_result(void);
+
+
+/**
+ * @brief Monotonic clock.
+ * @return milliseconds.
+ */
+uint32_t test_ms(void);
+
+
+/**
+ * @brief Run message_poll() until a box holds enough messages.
+ * @param box message box.
+ * @param count messages to wait for.
+ * @param timeout milliseconds to give up after.
+ * @return true: count reached.
+ */
+bool test_waitBox(MessageBox_t *box, uint8_t count, uint32_t timeout);
+
+
+/**
+ * @brief Build a preamble frame the way the ports send it.
+ * @param buffer room for 4 + 2 + sizeof(messagesize_t) + 1 + len + 4 bytes.
+ * @param des destination address.
+ * @param src source address.
+ * @param flags flags byte, 0 for none.
+ * @param data payload.
+ * @param len payload size.
+ * @return size of the frame.
+ */
+uint32_t test_frame(uint8_t *buffer,
+					uint8_t des,
+					uint8_t src,
+					uint8_t flags,
+					const void *data,
+					uint16_t len);
+
+
+/**
+ * @brief Write a whole buffer to a file descriptor.
+ * @return nothing.
+ */
+void test_write(int fd, const void *data, uint32_t len);
+
+#endif /* __TEST__ */
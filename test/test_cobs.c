@@ -0,0 +1,218 @@
+/**
+ * @file test_cobs.c
+ * @brief COBS encoder around the 254-byte block boundaries, then COBS
+ * frames of those lengths between two ports over a socketpair
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "message_cobs.h"
+
+#define DATA_SIZE   1100
+
+typedef enum Pattern {
+	kPatternNoZero = 0, /**< @brief longest blocks */
+	kPatternZero, /**< @brief a block per byte */
+	kPatternZeroAtBoundary, /**< @brief a zero right behind each full block */
+	kPatternRandom,
+	kPatterns
+} Pattern_t;
+
+static uint8_t encoded[DATA_SIZE + DATA_SIZE / 254 + 2];
+static uint32_t encodedLen;
+
+static void fill(uint8_t*, uint16_t, Pattern_t);
+static void append(void*, const void*, uint32_t);
+static int32_t decode(const uint8_t*, uint32_t, uint8_t*);
+static void testEncoder(uint16_t, Pattern_t);
+static void testPorts(void);
+
+
+int main(void) {
+	static const uint16_t lengths[] = { 0, 1, 2, 252, 253, 254, 255, 256,
+										506, 507, 508, 509, 510, 761, 762, 763,
+										1000, DATA_SIZE };
+
+	srand(1);
+
+	for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		for (Pattern_t pattern = 0; pattern < kPatterns; pattern++) {
+			testEncoder(lengths[i], pattern);
+		}
+	}
+
+	testPorts();
+
+	return test_result();
+}
+
+
+void fill(uint8_t *data, uint16_t len, Pattern_t pattern) {
+	for (uint16_t i = 0; i < len; i++) {
+		switch (pattern) {
+			case kPatternNoZero:
+				data[i] = 1 + i % 255;
+				break;
+
+			case kPatternZero:
+				data[i] = 0;
+				break;
+
+			case kPatternZeroAtBoundary:
+				data[i] = (i % 255 == 254) ? 0 : 0x80;
+				break;
+
+			default:
+				data[i] = (rand() % 4) ? rand() : 0;
+				break;
+		}
+	}
+}
+
+
+/**
+ * @brief MessageWrite_t collecting the encoder output.
+ */
+void append(void *context, const void *data, uint32_t len) {
+	(void)context;
+	memcpy(encoded + encodedLen, data, len);
+	encodedLen += len;
+}
+
+
+/**
+ * @brief reference decoder.
+ * @return decoded length, -1 if the frame is broken or not ended by the
+ * only 0x00.
+ */
+int32_t decode(const uint8_t *in, uint32_t len, uint8_t *out) {
+	uint32_t i = 0;
+	int32_t o = 0;
+
+	while (i < len && in[i]) {
+		uint8_t code = in[i++];
+
+		for (uint8_t k = 1; k < code; k++) {
+			if (i >= len || !in[i]) {
+				return -1;
+			}
+
+			out[o++] = in[i++];
+		}
+
+		// a full block is not followed by a zero
+		if (code < 0xFF && i < len && in[i]) {
+			out[o++] = 0;
+		}
+	}
+
+	return (i == len - 1 && in[i] == MESSAGE_COBS_DELIMITER) ? o : -1;
+}
+
+
+/**
+ * @brief encode in pieces and in place, both must decode to data.
+ */
+void testEncoder(uint16_t len, Pattern_t pattern) {
+	static uint8_t data[DATA_SIZE];
+	static uint8_t decoded[DATA_SIZE + 8];
+	static uint8_t buffer[DATA_SIZE + DATA_SIZE / 254 + 8];
+
+	fill(data, len, pattern);
+
+	// head, a payload split at the block boundary and a tail
+	uint16_t headLen = (len < 6) ? len : 6;
+	uint16_t tailLen = (len - headLen < 4) ? len - headLen : 4;
+	uint16_t size = len - headLen - tailLen;
+	uint16_t cut = (size < 250) ? size / 2 : 250;
+	MessageSegment_t head = { data, headLen };
+	MessageSegment_t segs[2] = { { data + headLen, cut },
+								{ data + headLen + cut, size - cut } };
+	MessageSegment_t tail = { data + len - tailLen, tailLen };
+
+	encodedLen = 0;
+	message_cobs_encode(&head, segs, 2, size, &tail, append, NULL);
+
+	if (!CHECK(memchr(encoded, 0, encodedLen) == encoded + encodedLen - 1)
+		|| !CHECK(encodedLen <= len + 1 + len / MESSAGE_COBS_BLOCK_SIZE + 1)
+		|| !CHECK(decode(encoded, encodedLen, decoded) == len)
+		|| !CHECK(memcmp(decoded, data, len) == 0))
+	{
+		printf("encode: length %u, pattern %d\n", len, pattern);
+		return;
+	}
+
+	uint16_t offset = 1 + len / MESSAGE_COBS_BLOCK_SIZE;
+
+	memcpy(buffer + offset, data, len);
+
+	if (!CHECK(message_cobs_encodeInPlace(buffer, offset, len) == encodedLen)
+		|| !CHECK(memcmp(buffer, encoded, encodedLen) == 0))
+	{
+		printf("encodeInPlace: length %u, pattern %d\n", len, pattern);
+	}
+}
+
+
+/**
+ * @brief payloads whose frame, 8 bytes around the payload, ends around
+ * the first and second block boundary; sent blocking and async.
+ */
+void testPorts(void) {
+	static Message_t slots1[4];
+	static Message_t slots2[64];
+	int sv[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	MessagePortHandle_t port1 = uart_messageport_create(sv[0], slots1, 4);
+	MessagePortHandle_t port2 = uart_messageport_create(sv[1], slots2, 64);
+	MessageBox_t *box = messageport_getBox(port2);
+
+	if (!CHECK(port1 != NULL && port2 != NULL)) {
+		return;
+	}
+
+	messageport_setFraming(port1, kMessageFramingCOBS);
+	messageport_setFraming(port2, kMessageFramingCOBS);
+
+	for (uint16_t len = 240; len <= 510; len++) {
+		if (len == 260) {
+			len = 490;
+		}
+
+		for (Pattern_t pattern = 0; pattern < kPatterns; pattern++) {
+			uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE];
+			Message_t message;
+			bool async = (len + pattern) & 1;
+
+			fill(payload, len, pattern);
+
+			if (async) {
+				CHECK(messageport_sendAsync(port1, testPreamble, 9, pattern,
+											payload, len, NULL) == 0);
+
+				while (messageport_isSending(port1)) {
+					sched_yield();
+				}
+			}
+			else {
+				messageport_send(port1, testPreamble, 9, pattern, payload, len);
+			}
+
+			if (!CHECK(test_waitBox(box, 1, 2000))
+				|| !CHECK(messagebox_pop(box, &message) == 0)
+				|| !CHECK(message.address == pattern && message.payloadSize == len)
+				|| !CHECK(memcmp(message.payload, payload, len) == 0))
+			{
+				printf("port: length %u, pattern %d, %s\n", len, pattern,
+						async ? "async" : "blocking");
+				return;
+			}
+		}
+	}
+}
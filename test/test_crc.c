@@ -0,0 +1,201 @@
+/**
+ * @file test_crc.c
+ * @brief CRC-32 against the check value and a bitwise reference, through
+ * the library, the table engine built with TEST_SLICING and the
+ * carry-less multiply folding, then checksums of two parts combined
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "crc32.h"
+
+#ifdef TEST_SLICING
+#undef CRC32_SLICING
+#define CRC32_SLICING   TEST_SLICING
+#endif
+#include "crc32_table.h"
+
+#if CRC32_CLMUL
+#include "crc32_clmul.h"
+#endif
+
+#define DATA_SIZE   1100
+
+static uint8_t data[DATA_SIZE];
+
+static crc32_t reference(const uint8_t*, uint32_t);
+static void testCheckValue(void);
+static void testSweep(void);
+static void testConcat(void);
+static void testCombine(void);
+#if CRC32_CLMUL
+static void testClmul(void);
+#endif
+
+
+int main(void) {
+	srand(1);
+
+	for (uint32_t i = 0; i < DATA_SIZE; i++) {
+		data[i] = (uint8_t)rand();
+	}
+
+	testCheckValue();
+	testSweep();
+	testConcat();
+	testCombine();
+#if CRC32_CLMUL
+	testClmul();
+#endif
+
+	return test_result();
+}
+
+
+/**
+ * @brief one bit at a time, reflected polynomial 0xEDB88320.
+ */
+crc32_t reference(const uint8_t *p, uint32_t len) {
+	crc32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *p++;
+
+		for (uint8_t k = 0; k < 8; k++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+
+/**
+ * @brief the CRC-32 of "123456789" every implementation agrees on.
+ */
+void testCheckValue(void) {
+	uint8_t check[] = "123456789";
+
+	CHECK(reference(check, 9) == 0xCBF43926);
+	CHECK(crc32_compute(check, 9) == 0xCBF43926);
+	CHECK(~crc32_slice(0xFFFFFFFF, check, 9) == 0xCBF43926);
+
+	CHECK(crc32_selfcheck(check, 9, 0xCBF43926) == 0);
+	check[4] ^= 0x10;
+	CHECK(crc32_selfcheck(check, 9, 0xCBF43926) == -1);
+}
+
+
+/**
+ * @brief every length around the slicing steps, at every alignment.
+ */
+void testSweep(void) {
+	for (uint32_t len = 0; len <= 300; len++) {
+		for (uint8_t offset = 0; offset < 4; offset++) {
+			crc32_t expected = reference(data + offset, len);
+
+			if (!CHECK(~crc32_slice(0xFFFFFFFF, data + offset, len) == expected)
+				|| !CHECK(crc32_compute(data + offset, len) == expected))
+			{
+				printf("slicing %u, length %u, offset %u\n", CRC32_SLICING, len, offset);
+				return;
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief a checksum carried on over a second part.
+ */
+void testConcat(void) {
+	crc32_t whole = reference(data, 300);
+
+	for (uint32_t split = 0; split <= 300; split++) {
+		crc32_t crc = crc32_concat(crc32_compute(data, split), data + split, 300 - split);
+
+		if (!CHECK(crc == whole)) {
+			printf("split %u\n", split);
+			return;
+		}
+	}
+
+	crc32_t crc = crc32_compute(data, 0);
+
+	for (uint32_t i = 0; i < 300; i++) {
+		crc = crc32_concatByte(crc, data[i]);
+	}
+
+	CHECK(crc == whole);
+}
+
+
+/**
+ * @brief two parts checksummed on their own, combined at every split.
+ */
+void testCombine(void) {
+	crc32_t whole = reference(data, DATA_SIZE);
+
+	for (uint32_t split = 0; split <= DATA_SIZE; split++) {
+		uint32_t lenB = DATA_SIZE - split;
+		crc32_t crcA = crc32_compute(data, split);
+		crc32_t crcB = crc32_compute(data + split, lenB);
+
+		if (!CHECK(crc32_combine(crcA, crcB, lenB) == whole)
+			|| !CHECK(crc32_combine_op(crcA, crcB, crc32_combine_gen(lenB)) == whole))
+		{
+			printf("split %u\n", split);
+			return;
+		}
+	}
+
+	// an operator is reused for every part of its length
+	crc32_t op = crc32_combine_gen(100);
+	crc32_t crc = crc32_compute(data, 0);
+
+	for (uint32_t i = 0; i < 10; i++) {
+		crc = crc32_combine_op(crc, crc32_compute(data + 100 * i, 100), op);
+	}
+
+	CHECK(crc == reference(data, 1000));
+}
+
+
+#if CRC32_CLMUL
+/**
+ * @brief folding alone, the tables only finish the tail, around the
+ * CRC32_CLMUL_MIN_SIZE cutover and over many blocks.
+ */
+void testClmul(void) {
+	static const uint32_t lengths[] = { 1024, 1025, 1039, DATA_SIZE - 4 };
+
+	if (!crc32_clmul_available()) {
+		printf("no carry-less multiply on this CPU, skipped\n");
+		return;
+	}
+
+	for (uint32_t len = CRC32_CLMUL_MIN_SIZE; len <= 300; len++) {
+		for (uint8_t offset = 0; offset < 4; offset++) {
+			uint32_t folded = len & ~15u;
+			crc32_t remainder = crc32_clmul(0xFFFFFFFF, data + offset, len);
+
+			remainder = crc32_slice(remainder, data + offset + folded, len - folded);
+
+			if (!CHECK(~remainder == reference(data + offset, len))) {
+				printf("length %u, offset %u\n", len, offset);
+				return;
+			}
+		}
+	}
+
+	// the library switches over at CRC32_CLMUL_MIN_SIZE
+	for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		CHECK(crc32_compute(data + 3, lengths[i]) == reference(data + 3, lengths[i]));
+	}
+
+	CHECK(crc32_compute(data, CRC32_CLMUL_MIN_SIZE - 1)
+			== reference(data, CRC32_CLMUL_MIN_SIZE - 1));
+}
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file test_fragment.c
+ * @brief Payloads split by messageport_send() and put back together on
+ * the far end of a socketpair; lost, foreign and oversized pieces
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "message_fragment.h"
+
+#define LONGEST 20000
+
+static uint8_t data[LONGEST];
+static uint8_t buffer[LONGEST];
+
+static int32_t receive(MessageBox_t*, MessageReassembly_t*, uint8_t);
+static void writePiece(int, uint8_t, uint16_t, uint16_t, uint16_t);
+static void testRoundTrip(void);
+static void testBrokenPieces(void);
+
+
+int main(void) {
+	for (uint16_t i = 0; i < LONGEST; i++) {
+		data[i] = i * 7 + (i >> 8);
+	}
+
+	testRoundTrip();
+	testBrokenPieces();
+
+	return test_result();
+}
+
+
+/**
+ * @brief wait for count frames and reassemble them.
+ * @return result of message_reassemble() for the last one, -2 if missing.
+ */
+int32_t receive(MessageBox_t *box, MessageReassembly_t *context, uint8_t count) {
+	Message_t message;
+	int32_t result = -2;
+
+	if (!test_waitBox(box, count, 2000)) {
+		return -2;
+	}
+
+	while (count-- && messagebox_pop(box, &message) == 0) {
+		result = message_reassemble(context, &message);
+	}
+
+	return result;
+}
+
+
+/**
+ * @brief one fragment of data, written as the port would send it.
+ */
+void writePiece(int fd, uint8_t src, uint16_t total, uint16_t offset, uint16_t len) {
+	uint8_t piece[MESSAGE_MAX_PAYLOAD_SIZE];
+	uint8_t frame[MESSAGE_MAX_PAYLOAD_SIZE + 16];
+
+	piece[0] = total;
+	piece[1] = total >> 8;
+	piece[2] = offset;
+	piece[3] = offset >> 8;
+	memcpy(piece + MESSAGE_FRAGMENT_HEADER_SIZE, data + offset, len);
+
+	test_write(fd, frame, test_frame(frame, 9, src, MESSAGE_FRAGMENT, piece,
+									MESSAGE_FRAGMENT_HEADER_SIZE + len));
+}
+
+
+void testRoundTrip(void) {
+	static const uint16_t lengths[] = { 1, MESSAGE_MAX_PAYLOAD_SIZE,
+										MESSAGE_MAX_PAYLOAD_SIZE + 1,
+										2 * MESSAGE_FRAGMENT_SIZE,
+										2 * MESSAGE_FRAGMENT_SIZE + 1,
+										5000, LONGEST };
+	static Message_t slots1[4];
+	static Message_t slots2[64];
+	MessageReassembly_t context;
+	int sv[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	MessagePortHandle_t port1 = uart_messageport_create(sv[0], slots1, 4);
+	MessagePortHandle_t port2 = uart_messageport_create(sv[1], slots2, 64);
+	MessageBox_t *box = messageport_getBox(port2);
+
+	if (!CHECK(port1 != NULL && port2 != NULL)) {
+		return;
+	}
+
+	message_reassembly_init(&context, buffer, sizeof(buffer));
+
+	for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		uint16_t len = lengths[i];
+		uint8_t pieces = (len <= MESSAGE_MAX_PAYLOAD_SIZE) ?
+						1 : (len + MESSAGE_FRAGMENT_SIZE - 1) / MESSAGE_FRAGMENT_SIZE;
+
+		memset(buffer, 0, sizeof(buffer));
+		messageport_send(port1, testPreamble, 9, 5, data + 1, len);
+
+		if (len <= MESSAGE_MAX_PAYLOAD_SIZE) {
+			// a single frame, not a fragment
+			CHECK(receive(box, &context, pieces) == -1);
+			continue;
+		}
+
+		if (!CHECK(receive(box, &context, pieces) == len)
+			|| !CHECK(memcmp(buffer, data + 1, len) == 0))
+		{
+			printf("length %u in %u pieces\n", len, pieces);
+		}
+	}
+}
+
+
+/**
+ * @brief raw pieces into a port: a gap, a foreign source and a payload
+ * too long for the buffer drop the payload in progress, not the next one.
+ */
+void testBrokenPieces(void) {
+	static Message_t slots[16];
+	MessageReassembly_t context;
+	int sv[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	MessagePortHandle_t port = uart_messageport_create(sv[0], slots, 16);
+	MessageBox_t *box = messageport_getBox(port);
+
+	if (!CHECK(port != NULL)) {
+		return;
+	}
+
+	// three pieces, the second one lost
+	message_reassembly_init(&context, buffer, sizeof(buffer));
+	writePiece(sv[1], 5, 300, 0, 100);
+	writePiece(sv[1], 5, 300, 200, 100);
+	CHECK(receive(box, &context, 2) == 0);
+
+	writePiece(sv[1], 5, 200, 0, 100);
+	writePiece(sv[1], 5, 200, 100, 100);
+	CHECK(receive(box, &context, 2) == 200);
+	CHECK(memcmp(buffer, data, 200) == 0);
+
+	// another source in between
+	writePiece(sv[1], 5, 200, 0, 100);
+	writePiece(sv[1], 6, 200, 100, 100);
+	writePiece(sv[1], 5, 200, 100, 100);
+	CHECK(receive(box, &context, 3) == 0);
+
+	// longer than the buffer
+	message_reassembly_init(&context, buffer, 150);
+	writePiece(sv[1], 5, 200, 0, 100);
+	writePiece(sv[1], 5, 200, 100, 100);
+	CHECK(receive(box, &context, 2) == 0);
+
+	writePiece(sv[1], 5, 150, 0, 100);
+	writePiece(sv[1], 5, 150, 100, 50);
+	CHECK(receive(box, &context, 2) == 150);
+	CHECK(memcmp(buffer, data, 150) == 0);
+}
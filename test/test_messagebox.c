@@ -0,0 +1,457 @@
+/**
+ * @file test_messagebox.c
+ * @brief Reading messages in place with messagebox_peek() and
+ * messagebox_release(); a producer and a consumer on two threads; priority
+ * lanes and overflow policies of the box behind a port, fed over a
+ * socketpair; overwriting under a concurrent reader
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "test.h"
+
+#define STRESS_MESSAGES 1000000
+
+static volatile int naks;
+static volatile uint8_t nakFrom;
+static MessageBox_t stressBox;
+static Message_t stressSlots[8];
+static volatile bool stressDone;
+
+static void fill(Message_t*, uint8_t);
+static uint8_t bySource(const Message_t*);
+static void onNak(MessagePortHandle_t, uint8_t);
+static bool waitLanes(MessageBox_t*, MessageBox_t*, uint8_t, uint8_t);
+static bool waitCounters(MessageBox_t*, uint16_t, uint16_t, uint16_t);
+static bool popText(MessageBox_t*, const char*);
+static void *produce(void*);
+static void *produceOverwriting(void*);
+static void testPeek(void);
+static void testStress(void);
+static void testLanes(MessagePortHandle_t, MessagePortHandle_t);
+static void testOverflow(MessagePortHandle_t, MessagePortHandle_t);
+static void testOverwriteStress(void);
+
+
+int main(void) {
+	static Message_t slots1[4];
+	static Message_t slots2[4];
+	int sv[2];
+
+	testPeek();
+	testStress();
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	MessagePortHandle_t port1 = uart_messageport_create(sv[0], slots1, 4);
+	MessagePortHandle_t port2 = uart_messageport_create(sv[1], slots2, 4);
+
+	if (CHECK(port1 != NULL && port2 != NULL)) {
+		testOverflow(port1, port2);
+		testLanes(port1, port2);
+	}
+
+	testOverwriteStress();
+
+	return test_result();
+}
+
+
+/**
+ * @brief a message of n bytes, each of them n.
+ */
+void fill(Message_t *message, uint8_t n) {
+	memset(message, 0, sizeof(Message_t));
+	message->payloadSize = n;
+	memset(message->payload, n, n);
+}
+
+
+/**
+ * @brief peek gives the oldest message and keeps its slot until release,
+ * an empty box gives NULL.
+ */
+void testPeek(void) {
+	static Message_t slots[3];
+	MessageBox_t box = messagebox_create(slots, 3);
+	Message_t message;
+
+	CHECK(messagebox_peek(&box) == NULL);
+
+	for (uint8_t n = 1; n <= 3; n++) {
+		fill(&message, n);
+		messagebox_push(&box, &message);
+	}
+
+	CHECK(messagebox_isFull(&box));
+
+	for (uint8_t n = 1; n <= 3; n++) {
+		const Message_t *peeked = messagebox_peek(&box);
+
+		if (!CHECK(peeked != NULL)) {
+			return;
+		}
+
+		// the same message until it is released
+		CHECK(peeked == messagebox_peek(&box));
+		CHECK(peeked->payloadSize == n && peeked->payload[n - 1] == n);
+		CHECK(messagebox_getUsedSpace(&box) == 4 - n);
+
+		messagebox_release(&box);
+		CHECK(messagebox_getFreeSpace(&box) == n);
+	}
+
+	CHECK(messagebox_isEmpty(&box));
+	CHECK(messagebox_peek(&box) == NULL);
+
+	// wraps around like pop does
+	for (uint8_t round = 0; round < 7; round++) {
+		fill(&message, round + 1);
+		messagebox_push(&box, &message);
+		fill(&message, round + 2);
+		messagebox_push(&box, &message);
+
+		const Message_t *peeked = messagebox_peek(&box);
+
+		CHECK(peeked && peeked->payloadSize == round + 1);
+		messagebox_release(&box);
+		CHECK(messagebox_pop(&box, &message) == 0 && message.payloadSize == round + 2);
+		CHECK(messagebox_isEmpty(&box));
+	}
+}
+
+
+/**
+ * @brief source 7 is urgent.
+ */
+uint8_t bySource(const Message_t *message) {
+	return (message->address == 7) ? 2 : 0;
+}
+
+
+void onNak(MessagePortHandle_t port, uint8_t address) {
+	(void)port;
+	nakFrom = address;
+	naks++;
+}
+
+
+/**
+ * @brief wait until a box and its lanes hold count messages.
+ */
+bool waitLanes(MessageBox_t *box, MessageBox_t *lanes, uint8_t n, uint8_t count) {
+	uint32_t start = test_ms();
+
+	do {
+		uint8_t used = messagebox_getUsedSpace(box);
+
+		for (uint8_t i = 0; i < n; i++) {
+			used += messagebox_getUsedSpace(&lanes[i]);
+		}
+
+		if (used >= count) {
+			return true;
+		}
+
+		usleep(1000);
+	} while (test_ms() - start < 2000);
+
+	return false;
+}
+
+
+/**
+ * @brief wait for the overflow counters of a box to reach a state.
+ */
+bool waitCounters(MessageBox_t *box, uint16_t dropped, uint16_t overwritten,
+					uint16_t rejected)
+{
+	uint32_t start = test_ms();
+	MessageBoxCounters_t counters;
+
+	do {
+		message_poll();
+		messagebox_getCounters(box, &counters);
+
+		if (counters.dropped == dropped && counters.overwritten == overwritten
+			&& counters.rejected == rejected)
+		{
+			return true;
+		}
+
+		usleep(1000);
+	} while (test_ms() - start < 2000);
+
+	return false;
+}
+
+
+bool popText(MessageBox_t *box, const char *text) {
+	Message_t message;
+
+	return messagebox_pop(box, &message) == 0
+			&& message.payloadSize == strlen(text)
+			&& !memcmp(message.payload, text, message.payloadSize);
+}
+
+
+/**
+ * @brief numbered messages, each payload 16 copies of its number.
+ */
+void *produce(void *argument) {
+	Message_t message;
+
+	(void)argument;
+	memset(&message, 0, sizeof(message));
+	message.payloadSize = 64;
+
+	for (uint32_t i = 1; i <= STRESS_MESSAGES; i++) {
+		for (uint8_t k = 0; k < 16; k++) {
+			memcpy(message.payload + 4 * k, &i, 4);
+		}
+
+		while (messagebox_isFull(&stressBox)) {
+			sched_yield();
+		}
+
+		messagebox_push(&stressBox, &message);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief numbered messages as fast as they go, the box overwrites.
+ */
+void *produceOverwriting(void *argument) {
+	Message_t message;
+
+	(void)argument;
+	memset(&message, 0, sizeof(message));
+	message.payloadSize = 64;
+
+	for (uint32_t i = 1; i <= STRESS_MESSAGES; i++) {
+		for (uint8_t k = 0; k < 16; k++) {
+			memcpy(message.payload + 4 * k, &i, 4);
+		}
+
+		messagebox_push(&stressBox, &message);
+	}
+
+	stressDone = true;
+
+	return NULL;
+}
+
+
+/**
+ * @brief the reader on another thread gets every message once, in order
+ * and never half written.
+ */
+void testStress(void) {
+	Message_t message;
+	pthread_t thread;
+	uint32_t last = 0;
+	uint32_t torn = 0;
+	uint32_t reordered = 0;
+
+	stressBox = messagebox_create(stressSlots, 8);
+	pthread_create(&thread, NULL, produce, NULL);
+
+	while (last < STRESS_MESSAGES) {
+		if (messagebox_pop(&stressBox, &message) == 0) {
+			uint32_t value;
+
+			memcpy(&value, message.payload, 4);
+
+			for (uint8_t k = 1; k < 16; k++) {
+				torn += memcmp(message.payload + 4 * k, &value, 4) != 0;
+			}
+
+			reordered += value != last + 1;
+			last = value;
+		}
+		else {
+			sched_yield();
+		}
+	}
+
+	pthread_join(thread, NULL);
+
+	CHECK(torn == 0);
+	CHECK(reordered == 0);
+}
+
+
+/**
+ * @brief drop newest, overwrite oldest, reject with a NAK to the sender.
+ */
+void testOverflow(MessagePortHandle_t port1, MessagePortHandle_t port2) {
+	MessageBox_t *box = messageport_getBox(port2);
+	char text[4];
+
+	messageport_setAddress(port2, 0x22, 0);
+	messageport_setNakHandler(port1, onNak);
+
+	for (uint8_t i = 0; i < 6; i++) {
+		sprintf(text, "d%u", i);
+		messageport_send(port1, testPreamble, 0x22, 0x11, text, 2);
+	}
+
+	CHECK(waitCounters(box, 2, 0, 0));
+	CHECK(popText(box, "d0") && popText(box, "d1")
+			&& popText(box, "d2") && popText(box, "d3"));
+	CHECK(messagebox_isEmpty(box));
+
+	messagebox_setOverflow(box, kMessageOverflowOverwrite);
+
+	for (uint8_t i = 0; i < 6; i++) {
+		sprintf(text, "o%u", i);
+		messageport_send(port1, testPreamble, 0x22, 0x11, text, 2);
+	}
+
+	CHECK(waitCounters(box, 2, 2, 0));
+	CHECK(popText(box, "o2") && popText(box, "o3")
+			&& popText(box, "o4") && popText(box, "o5"));
+	CHECK(messagebox_isEmpty(box));
+
+	messagebox_setOverflow(box, kMessageOverflowReject);
+
+	for (uint8_t i = 0; i < 5; i++) {
+		sprintf(text, "r%u", i);
+		messageport_send(port1, testPreamble, 0x22, 0x11, text, 2);
+	}
+
+	CHECK(waitCounters(box, 2, 2, 1));
+
+	// message_poll() sends the NAK, port1 hands it to its handler
+	uint32_t start = test_ms();
+
+	while (naks == 0 && test_ms() - start < 2000) {
+		message_poll();
+		usleep(1000);
+	}
+
+	CHECK(naks == 1 && nakFrom == 0x22);
+	CHECK(messagebox_isEmpty(messageport_getBox(port1)));
+	CHECK(popText(box, "r0") && popText(box, "r1")
+			&& popText(box, "r2") && popText(box, "r3"));
+
+	messagebox_setOverflow(box, kMessageOverflowDropNewest);
+	messageport_setAddress(port2, 0, 0);
+}
+
+
+/**
+ * @brief urgent messages overtake bulk ones, a full lane drops in that
+ * lane only, a classifier by source.
+ */
+void testLanes(MessagePortHandle_t port1, MessagePortHandle_t port2) {
+	static Message_t slots1[2];
+	static Message_t slots2[3];
+	MessageBox_t lanes[2] = { messagebox_create(slots1, 2), messagebox_create(slots2, 3) };
+	MessageBox_t *box = messageport_getBox(port2);
+	MessageSegment_t middle = { "mid", 3 };
+	MessageSegment_t urgent = { "urg", 3 };
+	MessageSegment_t top = { "top", 3 };
+	char text[8];
+
+	messagebox_setLanes(box, lanes, 2, NULL);
+
+	for (uint8_t i = 0; i < 4; i++) {
+		sprintf(text, "bulk%u", i);
+		messageport_send(port1, testPreamble, 1, 2, text, 5);
+	}
+
+	messageport_sendFlagged(port1, testPreamble, 1, 2, MESSAGE_PRIORITY(1), &middle, 1);
+	messageport_sendFlagged(port1, testPreamble, 1, 2, MESSAGE_PRIORITY(2), &urgent, 1);
+	// above the top lane, it goes there
+	messageport_sendFlagged(port1, testPreamble, 1, 2, MESSAGE_PRIORITY(3), &top, 1);
+
+	CHECK(waitLanes(box, lanes, 2, 7));
+	CHECK(popText(box, "urg"));
+	CHECK(popText(box, "top"));
+	CHECK(popText(box, "mid"));
+	CHECK(popText(box, "bulk0") && popText(box, "bulk1")
+			&& popText(box, "bulk2") && popText(box, "bulk3"));
+	CHECK(messagebox_isEmpty(box));
+
+	// lane 1 holds 2, the bulk lane is not touched
+	for (uint8_t i = 0; i < 4; i++) {
+		messageport_sendFlagged(port1, testPreamble, 1, 2, MESSAGE_PRIORITY(1),
+								&middle, 1);
+	}
+
+	messageport_send(port1, testPreamble, 1, 2, "bulk", 4);
+	CHECK(waitLanes(box, lanes, 2, 3));
+	usleep(20000);
+	CHECK(messagebox_getUsedSpace(&lanes[0]) == 2);
+	CHECK(popText(box, "mid") && popText(box, "mid") && popText(box, "bulk"));
+	CHECK(messagebox_isEmpty(box));
+
+	// a lane filling while a bulk message is peeked
+	messagebox_setLanes(box, lanes, 2, bySource);
+	messageport_send(port1, testPreamble, 1, 3, "low", 3);
+	CHECK(waitLanes(box, lanes, 2, 1));
+
+	const Message_t *peeked = messagebox_peek(box);
+
+	CHECK(peeked && peeked->payloadSize == 3 && !memcmp(peeked->payload, "low", 3));
+	messageport_send(port1, testPreamble, 1, 7, "hi", 2);
+	CHECK(waitLanes(box, lanes, 2, 2));
+	messagebox_release(box);
+	CHECK(popText(box, "hi"));
+	CHECK(messagebox_isEmpty(box));
+}
+
+
+/**
+ * @brief an overwriting producer never tears or reorders what the reader
+ * gets, and every message is either read or counted.
+ */
+void testOverwriteStress(void) {
+	MessageBoxCounters_t counters;
+	Message_t message;
+	pthread_t thread;
+	uint32_t last = 0;
+	uint32_t got = 0;
+	uint32_t torn = 0;
+
+	stressBox = messagebox_create(stressSlots, 8);
+	messagebox_setOverflow(&stressBox, kMessageOverflowOverwrite);
+	pthread_create(&thread, NULL, produceOverwriting, NULL);
+
+	for (;;) {
+		bool done = stressDone;
+
+		if (messagebox_pop(&stressBox, &message) == 0) {
+			uint32_t value;
+
+			memcpy(&value, message.payload, 4);
+
+			for (uint8_t k = 1; k < 16; k++) {
+				torn += memcmp(message.payload + 4 * k, &value, 4) != 0;
+			}
+
+			torn += value <= last;
+			last = value;
+			got++;
+		}
+		else if (done) {
+			break;
+		}
+	}
+
+	pthread_join(thread, NULL);
+	messagebox_getCounters(&stressBox, &counters);
+
+	CHECK(torn == 0);
+	CHECK(last == STRESS_MESSAGES);
+	// the counters are 16 bits wide
+	CHECK(((got + counters.overwritten) & 0xFFFF) == (STRESS_MESSAGES & 0xFFFF));
+}
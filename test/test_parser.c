@@ -0,0 +1,375 @@
+/**
+ * @file test_parser.c
+ * @brief Bulk parser: frames, noise and broken frames fed in every split,
+ * then the same stream through a port over a socketpair and back, a
+ * frame written out by hand, and a resync in the middle of a 9-bit frame
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "message_parser.h"
+#include "message_cobs.h"
+#include "crc32.h"
+
+#define FRAMES  100
+
+typedef struct Stream {
+	uint8_t data[FRAMES * (MESSAGE_MAX_PAYLOAD_SIZE + 64)];
+	uint32_t len;
+	uint16_t sizes[FRAMES]; /**< @brief payload size of each good frame */
+	uint8_t count; /**< @brief good frames */
+} Stream_t;
+
+static Stream_t stream;
+static uint8_t encoded[2 * MESSAGE_MAX_PAYLOAD_SIZE + 64];
+static uint32_t encodedLen;
+
+static void fillPayload(uint8_t*, uint16_t, uint8_t);
+static bool samePayload(const Message_t*, uint16_t, uint8_t);
+static void append(void*, const void*, uint32_t);
+static void buildStream(MessageFraming_t);
+static uint8_t feedSplit(MessageFraming_t, uint32_t);
+static void testSplits(MessageFraming_t);
+static void testPort(void);
+static void testKnownFrame(void);
+static uint32_t addressFrame(uint8_t*, const char*);
+static void testResync(void);
+
+
+int main(void) {
+	srand(1);
+
+	testSplits(kMessageFramingPreamble);
+	testSplits(kMessageFramingCOBS);
+	testPort();
+	testKnownFrame();
+	testResync();
+
+	return test_result();
+}
+
+
+/**
+ * @brief payload of frame i: zeros, 0xFF and a counter, so COBS has work.
+ */
+void fillPayload(uint8_t *payload, uint16_t len, uint8_t i) {
+	for (uint16_t k = 0; k < len; k++) {
+		payload[k] = (k % 5 == 0) ? 0 : (k % 7 == 0) ? 0xFF : (uint8_t)(i + k);
+	}
+}
+
+
+bool samePayload(const Message_t *message, uint16_t len, uint8_t i) {
+	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE];
+
+	fillPayload(payload, len, i);
+
+	return message->payloadSize == len && !memcmp(message->payload, payload, len);
+}
+
+
+/**
+ * @brief MessageWrite_t collecting the COBS encoder output.
+ */
+void append(void *context, const void *data, uint32_t len) {
+	(void)context;
+	memcpy(encoded + encodedLen, data, len);
+	encodedLen += len;
+}
+
+
+/**
+ * @brief good frames with noise, false preamble starts, frames with a bad
+ * checksum and truncated frames in between.
+ */
+void buildStream(MessageFraming_t framing) {
+	uint8_t payload[MESSAGE_MAX_PAYLOAD_SIZE];
+	uint8_t frame[MESSAGE_MAX_PAYLOAD_SIZE + 16];
+
+	memset(&stream, 0, sizeof(stream));
+
+	for (uint8_t i = 0; i < FRAMES; i++) {
+		uint16_t len = (i * 37) % (MESSAGE_MAX_PAYLOAD_SIZE + 1);
+		uint8_t kind = i % 5;
+
+		uint8_t noise = rand() % 12;
+
+		for (uint8_t k = 0; k < noise; k++) {
+			stream.data[stream.len++] = rand();
+		}
+
+		if (framing == kMessageFramingCOBS && noise) {
+			// COBS only resynchronises on the delimiter
+			stream.data[stream.len++] = 0;
+		}
+
+		if (framing == kMessageFramingPreamble && kind == 1) {
+			// the start of a preamble right before the real one
+			memcpy(stream.data + stream.len, testPreamble, 2);
+			stream.len += 2;
+		}
+
+		fillPayload(payload, len, i);
+		encodedLen = test_frame(frame, 9, i, 0, payload, len);
+
+		if (framing == kMessageFramingCOBS) {
+			// no preamble, the checksum covers the rest only
+			crc32_t checksum = crc32_compute(frame + MESSAGE_PREAMBLE_SIZE,
+											encodedLen - MESSAGE_PREAMBLE_SIZE
+											- sizeof(crc32_t));
+
+			memcpy(frame + encodedLen - sizeof(crc32_t), &checksum, sizeof(crc32_t));
+
+			MessageSegment_t head = { frame + MESSAGE_PREAMBLE_SIZE,
+									encodedLen - MESSAGE_PREAMBLE_SIZE };
+			MessageSegment_t tail = { NULL, 0 };
+
+			encodedLen = 0;
+			message_cobs_encode(&head, NULL, 0, 0, &tail, append, NULL);
+		}
+		else {
+			memcpy(encoded, frame, encodedLen);
+		}
+
+		if (kind == 3) {
+			// bad checksum: one bit of the payload or checksum flipped
+			encoded[encodedLen - 2] ^= 0x10;
+		}
+		else if (kind == 4 && framing == kMessageFramingCOBS) {
+			// cut off, the delimiter ends it early
+			encoded[encodedLen / 2] = 0;
+			encodedLen = encodedLen / 2 + 1;
+		}
+
+		memcpy(stream.data + stream.len, encoded, encodedLen);
+		stream.len += encodedLen;
+
+		if (kind != 3 && !(kind == 4 && framing == kMessageFramingCOBS)) {
+			stream.sizes[stream.count++] = len;
+		}
+	}
+}
+
+
+/**
+ * @brief feed the stream split every split bytes.
+ * @return good frames received in order.
+ */
+uint8_t feedSplit(MessageFraming_t framing, uint32_t split) {
+	MessageParser_t parser;
+	uint8_t got = 0;
+	uint8_t frame = 0;
+
+	message_parser_init(&parser, testPreamble);
+	message_parser_setFraming(&parser, framing);
+
+	for (uint32_t offset = 0; offset < stream.len; offset += split) {
+		uint32_t chunk = (stream.len - offset < split) ? stream.len - offset : split;
+		uint32_t used = 0;
+
+		while (used < chunk) {
+			used += message_parser_feed(&parser, stream.data + offset + used,
+										chunk - used);
+
+			const Message_t *message = message_parser_getMessage(&parser);
+
+			if (message == NULL) {
+				continue;
+			}
+
+			// addresses count the frames built, good or not
+			while (frame < FRAMES && (frame % 5 == 3
+					|| (framing == kMessageFramingCOBS && frame % 5 == 4)))
+			{
+				frame++;
+			}
+
+			if (got < stream.count && message->address == frame
+				&& message->destination == 9
+				&& samePayload(message, stream.sizes[got], frame))
+			{
+				got++;
+			}
+
+			frame++;
+		}
+	}
+
+	return got;
+}
+
+
+void testSplits(MessageFraming_t framing) {
+	buildStream(framing);
+
+	for (uint32_t split = 1; split <= 64; split++) {
+		if (!CHECK(feedSplit(framing, split) == stream.count)) {
+			printf("framing %d, split %u\n", framing, split);
+		}
+	}
+
+	CHECK(feedSplit(framing, stream.len) == stream.count);
+}
+
+
+/**
+ * @brief the stream written into a port in odd chunks, then every frame
+ * sent back by the port and parsed at the far end.
+ */
+void testPort(void) {
+	static Message_t slots[128];
+	int sv[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	MessagePortHandle_t port = uart_messageport_create(sv[0], slots, 128);
+	MessageBox_t *box = messageport_getBox(port);
+
+	CHECK(port != NULL);
+	buildStream(kMessageFramingPreamble);
+
+	for (uint32_t offset = 0; offset < stream.len; ) {
+		uint32_t chunk = 1 + rand() % 300;
+
+		chunk = (stream.len - offset < chunk) ? stream.len - offset : chunk;
+		test_write(sv[1], stream.data + offset, chunk);
+		offset += chunk;
+	}
+
+	CHECK(test_waitBox(box, stream.count, 5000));
+
+	Message_t message;
+	uint8_t got = 0;
+
+	for (uint8_t frame = 0; frame < FRAMES; frame++) {
+		if (frame % 5 == 3) {
+			continue;
+		}
+
+		if (!CHECK(messagebox_pop(box, &message) == 0)) {
+			break;
+		}
+
+		if (CHECK(message.address == frame)
+			&& CHECK(samePayload(&message, stream.sizes[got], frame)))
+		{
+			messageport_send(port, testPreamble, 9, frame,
+							message.payload, message.payloadSize);
+		}
+
+		got++;
+	}
+
+	CHECK(messagebox_isEmpty(box));
+
+	// and back
+	MessageParser_t parser;
+	uint8_t buffer[512];
+	uint8_t back = 0;
+
+	message_parser_init(&parser, testPreamble);
+
+	while (back < got) {
+		struct pollfd fd = { sv[1], POLLIN, 0 };
+
+		if (!CHECK(poll(&fd, 1, 2000) == 1)) {
+			break;
+		}
+
+		ssize_t n = read(sv[1], buffer, sizeof(buffer));
+		uint32_t used = 0;
+
+		while (n > 0 && used < (uint32_t)n) {
+			used += message_parser_feed(&parser, buffer + used, n - used);
+
+			const Message_t *m = message_parser_getMessage(&parser);
+
+			if (m) {
+				// every fifth frame, the one with a bad checksum, is missing
+				uint8_t frame = back / 4 * 5 + ((back % 4 == 3) ? 4 : back % 4);
+
+				CHECK(m->address == frame && samePayload(m, stream.sizes[back], frame));
+				back++;
+			}
+		}
+	}
+
+	CHECK(back == got);
+}
+
+
+/**
+ * @brief a frame with its checksum worked out independently, the other
+ * tests build theirs with crc32_compute() as well.
+ */
+void testKnownFrame(void) {
+	static const uint8_t known[] = {
+		0xAA, 0xBB, 0xCC, 0xDD, 9, 1,
+#if MESSAGE_MAX_PAYLOAD_SIZE > 0x7F || MESSAGE_LENGTH_16BIT
+		0x05, 0x00, 'h', 'e', 'l', 'l', 'o', 0x1B, 0xC1, 0x1C, 0xE0
+#else
+		0x05, 'h', 'e', 'l', 'l', 'o', 0x27, 0xFB, 0xB2, 0x0B
+#endif
+	};
+	MessageParser_t parser;
+	uint8_t buffer[64];
+
+	CHECK(test_frame(buffer, 9, 1, 0, "hello", 5) == sizeof(known)
+			&& !memcmp(buffer, known, sizeof(known)));
+
+	message_parser_init(&parser, testPreamble);
+
+	CHECK(message_parser_feed(&parser, known, sizeof(known)) == sizeof(known));
+
+	const Message_t *message = message_parser_getMessage(&parser);
+
+	CHECK(message && message->address == 1 && message->payloadSize == 5
+			&& !memcmp(message->payload, "hello", 5));
+}
+
+
+/**
+ * @brief 9-bit frame, from the address on, checksummed without preamble.
+ */
+uint32_t addressFrame(uint8_t *buffer, const char *text) {
+	uint32_t len = test_frame(buffer, 9, 1, 0, text, strlen(text)) - MESSAGE_PREAMBLE_SIZE;
+	crc32_t checksum;
+
+	memmove(buffer, buffer + MESSAGE_PREAMBLE_SIZE, len);
+	checksum = crc32_compute(buffer, len - sizeof(crc32_t));
+	memcpy(buffer + len - sizeof(crc32_t), &checksum, sizeof(crc32_t));
+
+	return len;
+}
+
+
+/**
+ * @brief half a frame, a resync as for the next address character, then
+ * a whole frame that must not be taken as the rest of the first.
+ */
+void testResync(void) {
+	MessageParser_t parser;
+	uint8_t cut[64];
+	uint8_t whole[64];
+	uint32_t cutLen = addressFrame(cut, "cut-frame");
+	uint32_t wholeLen = addressFrame(whole, "whole");
+
+	message_parser_init(&parser, testPreamble);
+	message_parser_setFraming(&parser, kMessageFramingAddress);
+
+	CHECK(message_parser_feed(&parser, cut, cutLen / 2) == cutLen / 2);
+	CHECK(message_parser_getMessage(&parser) == NULL);
+
+	message_parser_resync(&parser);
+
+	CHECK(message_parser_feed(&parser, whole, wholeLen) == wholeLen);
+
+	const Message_t *message = message_parser_getMessage(&parser);
+
+	CHECK(message && message->payloadSize == 5 && !memcmp(message->payload, "whole", 5));
+}
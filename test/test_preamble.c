@@ -0,0 +1,157 @@
+/**
+ * @file test_preamble.c
+ * @brief Vectorized preamble scan against a byte-wise one: a preamble at
+ * every offset across the 16- and 32-byte blocks, preambles cut by the
+ * end, noisy streams and the max cutoff
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "preamble_scan.h"
+
+#define DATA_SIZE   200
+
+static uint32_t naive(const uint8_t*, uint32_t, uint32_t*, uint32_t);
+static bool sameScan(const uint8_t*, uint32_t, uint32_t);
+static void testOffsets(void);
+static void testCut(void);
+static void testNoise(void);
+static void testMax(void);
+
+
+int main(void) {
+	srand(1);
+
+	testOffsets();
+	testCut();
+	testNoise();
+	testMax();
+
+	return test_result();
+}
+
+
+uint32_t naive(const uint8_t *data, uint32_t len, uint32_t *starts, uint32_t max) {
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; count < max && i + MESSAGE_PREAMBLE_SIZE <= len; i++) {
+		if (!memcmp(data + i, testPreamble, MESSAGE_PREAMBLE_SIZE)) {
+			starts[count++] = i;
+		}
+	}
+
+	return count;
+}
+
+
+/**
+ * @brief both scans find the same starts, up to max of them.
+ */
+bool sameScan(const uint8_t *data, uint32_t len, uint32_t max) {
+	uint32_t expected[DATA_SIZE];
+	uint32_t starts[DATA_SIZE];
+	uint32_t count = naive(data, len, expected, max);
+
+	return preamble_scan(data, len, testPreamble, starts, max) == count
+			&& !memcmp(starts, expected, count * sizeof(uint32_t));
+}
+
+
+/**
+ * @brief one preamble at every offset, in buffers of every length around
+ * the block sizes.
+ */
+void testOffsets(void) {
+	uint8_t data[DATA_SIZE];
+
+	for (uint32_t len = MESSAGE_PREAMBLE_SIZE; len <= 70; len++) {
+		for (uint32_t at = 0; at + MESSAGE_PREAMBLE_SIZE <= len; at++) {
+			uint32_t start = ~0u;
+
+			memset(data, 0x55, len);
+			memcpy(data + at, testPreamble, MESSAGE_PREAMBLE_SIZE);
+
+			if (!CHECK(preamble_scan(data, len, testPreamble, &start, 1) == 1)
+				|| !CHECK(start == at))
+			{
+				printf("length %u, offset %u\n", len, at);
+				return;
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief a preamble cut by the end of the buffer is not reported, also
+ * right behind a block.
+ */
+void testCut(void) {
+	uint8_t data[DATA_SIZE];
+	uint32_t start;
+
+	for (uint32_t len = 16; len <= 68; len += 4) {
+		for (uint32_t cut = 1; cut < MESSAGE_PREAMBLE_SIZE; cut++) {
+			memset(data, 0x55, len);
+			memcpy(data + len - cut, testPreamble, cut);
+
+			if (!CHECK(preamble_scan(data, len, testPreamble, &start, 1) == 0)) {
+				printf("length %u, cut %u\n", len, cut);
+				return;
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief bytes drawn from the preamble itself, so partial matches and
+ * preambles back to back are common.
+ */
+void testNoise(void) {
+	uint8_t data[DATA_SIZE];
+
+	for (uint32_t round = 0; round < 2000; round++) {
+		uint32_t len = rand() % (DATA_SIZE + 1);
+
+		for (uint32_t i = 0; i < len; i++) {
+			data[i] = (rand() % 3 == 0) ? 0x00 : testPreamble[rand() % MESSAGE_PREAMBLE_SIZE];
+		}
+
+		// and a few whole ones
+		for (uint32_t i = 0; i + MESSAGE_PREAMBLE_SIZE <= len; i += 1 + rand() % 40) {
+			memcpy(data + i, testPreamble, MESSAGE_PREAMBLE_SIZE);
+		}
+
+		if (!CHECK(sameScan(data, len, DATA_SIZE))) {
+			printf("round %u\n", round);
+			return;
+		}
+	}
+}
+
+
+/**
+ * @brief the scan stops at max, with the first starts in order, also
+ * when max is reached in the middle of a block.
+ */
+void testMax(void) {
+	uint8_t data[DATA_SIZE];
+
+	memset(data, 0x55, sizeof(data));
+
+	// back to back inside the first block, then one per block edge
+	for (uint32_t at = 0; at + MESSAGE_PREAMBLE_SIZE <= DATA_SIZE; ) {
+		memcpy(data + at, testPreamble, MESSAGE_PREAMBLE_SIZE);
+		at += (at < 12) ? MESSAGE_PREAMBLE_SIZE : 15;
+	}
+
+	for (uint32_t max = 0; max <= DATA_SIZE / MESSAGE_PREAMBLE_SIZE; max++) {
+		if (!CHECK(sameScan(data, sizeof(data), max))) {
+			printf("max %u\n", max);
+			return;
+		}
+	}
+}
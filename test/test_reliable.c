@@ -0,0 +1,367 @@
+/**
+ * @file test_reliable.c
+ * @brief Reliable delivery between two ports over socketpairs: the window,
+ * selective ACKs and retransmissions frame by frame, then a lossy line
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "message_parser.h"
+#include "message_reliable.h"
+
+#define TIMEOUT 100
+#define STRESS_MESSAGES 200
+#define STRESS_DROP     5 /**< @brief bytes lost per 1000 */
+
+/**
+ * @brief Struct contains one direction of the line, frames pass the test.
+ */
+typedef struct Relay {
+	int from;
+	int to;
+	MessageParser_t parser;
+	uint8_t frame[MESSAGE_MAX_PAYLOAD_SIZE + 16];
+	uint32_t frameLen;
+} Relay_t;
+
+/**
+ * @brief Struct contains one direction of the lossy line.
+ */
+typedef struct LossyLine {
+	int from;
+	int to;
+	unsigned seed;
+} LossyLine_t;
+
+static void relayInit(Relay_t*, int, int);
+static uint8_t relay(Relay_t*, uint32_t, uint8_t*);
+static bool waitHave(MessagePeer_t*, uint8_t, uint32_t);
+static bool waitInFlight(MessagePeer_t*, uint8_t);
+static bool popText(MessageBox_t*, const char*);
+static void *lossyLine(void*);
+static void testWindow(void);
+static void testLossyLine(void);
+
+
+int main(void) {
+	testWindow();
+	testLossyLine();
+
+	return test_result();
+}
+
+
+void relayInit(Relay_t *relay, int from, int to) {
+	relay->from = from;
+	relay->to = to;
+	relay->frameLen = 0;
+	message_parser_init(&relay->parser, testPreamble);
+}
+
+
+/**
+ * @brief pass the frames on until the line stays idle for 50 ms.
+ * @param drop bit i set: frame i is lost.
+ * @param seqs sequence number of each frame, may be NULL.
+ * @return frames seen.
+ */
+uint8_t relay(Relay_t *relay, uint32_t drop, uint8_t *seqs) {
+	uint8_t buffer[256];
+	uint8_t frames = 0;
+	struct pollfd fd = { relay->from, POLLIN, 0 };
+
+	while (poll(&fd, 1, 50) == 1) {
+		ssize_t n = read(relay->from, buffer, sizeof(buffer));
+		uint32_t used = 0;
+
+		while (n > 0 && used < (uint32_t)n) {
+			uint32_t step = message_parser_feed(&relay->parser, buffer + used, n - used);
+
+			memcpy(relay->frame + relay->frameLen, buffer + used, step);
+			relay->frameLen += step;
+			used += step;
+
+			const Message_t *message = message_parser_getMessage(&relay->parser);
+
+			if (message == NULL) {
+				continue;
+			}
+
+			if (seqs && frames < 32) {
+				seqs[frames] = message->payload[0];
+			}
+
+			if (!(drop & (1UL << frames))) {
+				test_write(relay->to, relay->frame, relay->frameLen);
+			}
+
+			relay->frameLen = 0;
+			frames++;
+		}
+	}
+
+	return frames;
+}
+
+
+/**
+ * @brief wait for the receive side of a peer to get to a state.
+ */
+bool waitHave(MessagePeer_t *peer, uint8_t next, uint32_t have) {
+	uint32_t start = test_ms();
+
+	while (peer->rxNext != next || peer->rxHave != have) {
+		if (test_ms() - start > 2000) {
+			return false;
+		}
+
+		usleep(1000);
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief wait for an ACK to slide the window of a peer.
+ */
+bool waitInFlight(MessagePeer_t *peer, uint8_t inFlight) {
+	uint32_t start = test_ms();
+
+	while (message_peer_inFlight(peer) != inFlight) {
+		if (test_ms() - start > 2000) {
+			return false;
+		}
+
+		usleep(1000);
+	}
+
+	return true;
+}
+
+
+bool popText(MessageBox_t *box, const char *text) {
+	Message_t message;
+
+	return messagebox_pop(box, &message) == 0
+			&& message.payloadSize == strlen(text)
+			&& !memcmp(message.payload, text, message.payloadSize)
+			&& message.address == 1;
+}
+
+
+/**
+ * @brief window of 4, the second frame lost, later an ACK lost.
+ */
+void testWindow(void) {
+	static Message_t slots1[4];
+	static Message_t slots2[8];
+	static Message_t peerSlots1[8];
+	static Message_t peerSlots2[8];
+	MessagePeer_t peer1;
+	MessagePeer_t peer2;
+	Relay_t forward;
+	Relay_t backward;
+	uint8_t seqs[32];
+	int a[2];
+	int b[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0);
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0);
+
+	MessagePortHandle_t port1 = uart_messageport_create(a[0], slots1, 4);
+	MessagePortHandle_t port2 = uart_messageport_create(b[0], slots2, 8);
+	MessageBox_t *box = messageport_getBox(port2);
+
+	if (!CHECK(port1 != NULL && port2 != NULL)) {
+		return;
+	}
+
+	relayInit(&forward, a[1], b[1]);
+	relayInit(&backward, b[1], a[1]);
+	message_peer_init(&peer1, testPreamble, 1, 2, peerSlots1, 4, TIMEOUT);
+	message_peer_init(&peer2, testPreamble, 2, 1, peerSlots2, 4, TIMEOUT);
+	messageport_addPeer(port1, &peer1);
+	messageport_addPeer(port2, &peer2);
+
+	// the window takes 4
+	CHECK(message_sendReliable(&peer1, "m0", 2, 0) == 0);
+	CHECK(message_sendReliable(&peer1, "m1", 2, 0) == 0);
+	CHECK(message_sendReliable(&peer1, "m2", 2, 0) == 0);
+	CHECK(message_sendReliable(&peer1, "m3", 2, 0) == 0);
+	CHECK(message_sendReliable(&peer1, "m4", 2, 0) == -1);
+	CHECK(message_peer_inFlight(&peer1) == 4);
+
+	// m1 lost: m0 delivered, m2 and m3 held
+	CHECK(relay(&forward, 1UL << 1, seqs) == 4);
+	CHECK(seqs[0] == 0 && seqs[1] == 1 && seqs[2] == 2 && seqs[3] == 3);
+	CHECK(waitHave(&peer2, 1, 0x6));
+	CHECK(messagebox_getUsedSpace(box) == 1);
+
+	// selective ACK: 1 expected, 2 and 3 held
+	message_peer_poll(&peer2, 0);
+	CHECK(relay(&backward, 0, NULL) == 1);
+	CHECK(waitInFlight(&peer1, 3));
+
+	// nothing due before the timeout, then m1 only
+	message_peer_poll(&peer1, TIMEOUT - 1);
+	CHECK(relay(&forward, 0, NULL) == 0);
+	message_peer_poll(&peer1, TIMEOUT);
+	CHECK(relay(&forward, 0, seqs) == 1);
+	CHECK(seqs[0] == 1);
+
+	CHECK(test_waitBox(box, 4, 2000));
+	CHECK(popText(box, "m0"));
+	CHECK(popText(box, "m1"));
+	CHECK(popText(box, "m2"));
+	CHECK(popText(box, "m3"));
+
+	message_peer_poll(&peer2, TIMEOUT);
+	CHECK(relay(&backward, 0, NULL) == 1);
+	CHECK(waitInFlight(&peer1, 0));
+	message_peer_poll(&peer1, 3 * TIMEOUT);
+	CHECK(relay(&forward, 0, NULL) == 0);
+
+	// the ACK of m4 lost: m4 comes again, it is not delivered twice
+	CHECK(message_sendReliable(&peer1, "m4", 2, 3 * TIMEOUT) == 0);
+	CHECK(relay(&forward, 0, NULL) == 1);
+	CHECK(test_waitBox(box, 1, 2000));
+	message_peer_poll(&peer2, 3 * TIMEOUT);
+	CHECK(relay(&backward, 1, NULL) == 1);
+
+	message_peer_poll(&peer1, 4 * TIMEOUT);
+	CHECK(relay(&forward, 0, seqs) == 1);
+	CHECK(seqs[0] == 4);
+	CHECK(waitHave(&peer2, 5, 0));
+	message_peer_poll(&peer2, 4 * TIMEOUT);
+	CHECK(relay(&backward, 0, NULL) == 1);
+	CHECK(waitInFlight(&peer1, 0));
+
+	CHECK(popText(box, "m4"));
+	CHECK(messagebox_isEmpty(box));
+
+	// a reliable frame sent with a priority keeps it
+	uint8_t high[] = { 5, 'p', '2' };
+	MessageSegment_t segment = { high, sizeof(high) };
+	Message_t message;
+
+	messageport_sendFlagged(port1, testPreamble, 2, 1,
+							MESSAGE_RELIABLE | MESSAGE_PRIORITY(2), &segment, 1);
+	CHECK(relay(&forward, 0, NULL) == 1);
+	CHECK(test_waitBox(box, 1, 2000));
+	CHECK(messagebox_pop(box, &message) == 0
+			&& (message.flags & MESSAGE_PRIORITY_MASK) == MESSAGE_PRIORITY(2)
+			&& message.payloadSize == 2 && !memcmp(message.payload, "p2", 2));
+}
+
+
+/**
+ * @brief copy bytes between two sockets, losing some.
+ */
+void *lossyLine(void *argument) {
+	LossyLine_t *line = argument;
+	uint8_t buffer[256];
+
+	for (;;) {
+		ssize_t n = read(line->from, buffer, sizeof(buffer));
+		ssize_t kept = 0;
+
+		if (n <= 0) {
+			return NULL;
+		}
+
+		for (ssize_t i = 0; i < n; i++) {
+			if (rand_r(&line->seed) % 1000 >= STRESS_DROP) {
+				buffer[kept++] = buffer[i];
+			}
+		}
+
+		test_write(line->to, buffer, kept);
+	}
+}
+
+
+/**
+ * @brief every message arrives once and in order over a line losing bytes.
+ */
+void testLossyLine(void) {
+	static Message_t slots1[4];
+	static Message_t slots2[4];
+	static Message_t peerSlots1[2 * MESSAGE_WINDOW_MAX];
+	static Message_t peerSlots2[2 * MESSAGE_WINDOW_MAX];
+	MessagePeer_t peer1;
+	MessagePeer_t peer2;
+	pthread_t threads[2];
+	int a[2];
+	int b[2];
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0);
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0);
+
+	MessagePortHandle_t port1 = uart_messageport_create(a[0], slots1, 4);
+	MessagePortHandle_t port2 = uart_messageport_create(b[0], slots2, 4);
+	MessageBox_t *box = messageport_getBox(port2);
+	LossyLine_t forward = { a[1], b[1], 1 };
+	LossyLine_t backward = { b[1], a[1], 2 };
+
+	if (!CHECK(port1 != NULL && port2 != NULL)) {
+		return;
+	}
+
+	pthread_create(&threads[0], NULL, lossyLine, &forward);
+	pthread_create(&threads[1], NULL, lossyLine, &backward);
+
+	message_peer_init(&peer1, testPreamble, 1, 2, peerSlots1, MESSAGE_WINDOW_MAX, 30);
+	message_peer_init(&peer2, testPreamble, 2, 1, peerSlots2, MESSAGE_WINDOW_MAX, 30);
+	messageport_addPeer(port1, &peer1);
+	messageport_addPeer(port2, &peer2);
+
+	uint16_t sent = 0;
+	uint16_t got = 0;
+	uint32_t start = test_ms();
+
+	while ((got < STRESS_MESSAGES || message_peer_inFlight(&peer1))
+			&& test_ms() - start < 30000)
+	{
+		char text[16];
+		Message_t message;
+
+		message_poll();
+
+		if (sent < STRESS_MESSAGES) {
+			int len = sprintf(text, "msg %u", sent);
+
+			if (message_sendReliable(&peer1, text, len, test_ms()) == 0) {
+				sent++;
+			}
+		}
+
+		message_peer_poll(&peer1, test_ms());
+		message_peer_poll(&peer2, test_ms());
+
+		// a slow reader, the box runs full now and then
+		if (rand() % 3 == 0 && messagebox_pop(box, &message) == 0) {
+			int len = sprintf(text, "msg %u", got);
+
+			if (!CHECK(message.payloadSize == len
+						&& !memcmp(message.payload, text, len)))
+			{
+				printf("message %u: %.*s\n", got, message.payloadSize, message.payload);
+				return;
+			}
+
+			got++;
+		}
+
+		usleep(200);
+	}
+
+	CHECK(got == STRESS_MESSAGES);
+	CHECK(message_peer_inFlight(&peer1) == 0);
+}
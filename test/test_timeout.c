@@ -0,0 +1,150 @@
+/**
+ * @file test_timeout.c
+ * @brief Line timeouts in deferred mode, over a pty so the port measures
+ * them: a pause inside a frame drops it, several pauses queued before one
+ * message_poll() each drop their own frame
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/**
+ * @brief pause long enough for the line timeout at 1200 baud (25 ms)
+ */
+#define PAUSE   100000
+
+static int openPty(int*);
+static uint32_t frame(uint8_t*, const char*);
+static bool popText(MessageBox_t*, const char*);
+static void testCut(int, MessageBox_t*);
+static void testQueued(int, MessageBox_t*);
+
+
+int main(void) {
+	static Message_t slots[8];
+	int master;
+	int slave = openPty(&master);
+
+	if (!CHECK(slave >= 0)) {
+		return test_result();
+	}
+
+	MessagePortHandle_t port = uart_messageport_create(slave, slots, 8);
+
+	if (CHECK(port != NULL)) {
+		testCut(master, messageport_getBox(port));
+		testQueued(master, messageport_getBox(port));
+	}
+
+	return test_result();
+}
+
+
+/**
+ * @brief raw pty at 1200 baud, the port takes its speed from there.
+ * @return the end for the port, -1 on failure.
+ */
+int openPty(int *master) {
+	struct termios tty;
+
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (*master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0) {
+		return -1;
+	}
+
+	int slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+
+	if (slave < 0) {
+		return -1;
+	}
+
+	tcgetattr(slave, &tty);
+	cfmakeraw(&tty);
+	cfsetospeed(&tty, B1200);
+	cfsetispeed(&tty, B1200);
+	tcsetattr(slave, TCSANOW, &tty);
+
+	tcgetattr(*master, &tty);
+	cfmakeraw(&tty);
+	tcsetattr(*master, TCSANOW, &tty);
+
+	return slave;
+}
+
+
+uint32_t frame(uint8_t *buffer, const char *text) {
+	return test_frame(buffer, 9, 1, 0, text, strlen(text));
+}
+
+
+bool popText(MessageBox_t *box, const char *text) {
+	Message_t message;
+
+	return messagebox_pop(box, &message) == 0
+			&& message.payloadSize == strlen(text)
+			&& !memcmp(message.payload, text, message.payloadSize);
+}
+
+
+/**
+ * @brief a frame written in two quick pieces arrives, one with a pause
+ * in the middle is dropped and the next frame still arrives.
+ */
+void testCut(int fd, MessageBox_t *box) {
+	uint8_t buffer[64];
+	uint32_t len = frame(buffer, "quick");
+
+	test_write(fd, buffer, len / 2);
+	test_write(fd, buffer + len / 2, len - len / 2);
+	CHECK(test_waitBox(box, 1, 2000));
+	CHECK(popText(box, "quick"));
+
+	len = frame(buffer, "paused");
+	test_write(fd, buffer, len / 2);
+	usleep(PAUSE);
+	test_write(fd, buffer + len / 2, len - len / 2);
+	usleep(PAUSE);
+
+	len = frame(buffer, "next");
+	test_write(fd, buffer, len);
+	CHECK(test_waitBox(box, 1, 2000));
+	CHECK(popText(box, "next"));
+	CHECK(messagebox_isEmpty(box));
+}
+
+
+/**
+ * @brief two cut frames and a whole one before message_poll() runs.
+ */
+void testQueued(int fd, MessageBox_t *box) {
+	uint8_t first[64];
+	uint8_t second[64];
+	uint8_t whole[64];
+	uint32_t firstLen = frame(first, "first-frame-cut");
+	uint32_t wholeLen = frame(whole, "whole");
+
+	frame(second, "second-frame-cut");
+
+	for (uint8_t round = 0; round < 10; round++) {
+		test_write(fd, first, firstLen / 2);
+		usleep(PAUSE);
+		// cut right behind the header
+		test_write(fd, second, MESSAGE_PREAMBLE_SIZE + 2 + sizeof(messagesize_t));
+		usleep(PAUSE);
+		test_write(fd, whole, wholeLen);
+		usleep(PAUSE);
+
+		message_poll();
+
+		if (!CHECK(popText(box, "whole")) || !CHECK(messagebox_isEmpty(box))) {
+			printf("round %u\n", round);
+			return;
+		}
+	}
+}